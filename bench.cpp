@@ -0,0 +1,250 @@
+
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+// Codec and record parser micro benchmarks, make bench
+// usage: orientbench [-t seconds] [name-filter]
+
+#include <time.h>
+#include <new>
+#include "db.h"
+
+using namespace OrientPP;
+using namespace json;
+
+static u64 allocs, alloc_bytes;
+
+void *operator new(size_t n)
+{
+ allocs++;
+ alloc_bytes += n;
+ void *p = malloc(n ? n : 1);
+ if (!p)
+   throw std::bad_alloc();
+ return p;
+}
+
+void operator delete(void *p) noexcept
+{
+ free(p);
+}
+
+// documents as the server sends them
+static const char *doc_simple = "Person@name:\"John Smith\",age:42,height:1.85f,weight:81.5d,"
+  "born:631152000000t,active:true,balance:12345678901l,city:\"Kyiv\",note:\"a \\\"quoted\\\" text\"";
+static const char *doc_links = "V@name:\"node 17\",out:[#9:1,#9:2,#9:3,#9:4,#9:5,#9:6],"
+  "in:[#10:5,#10:6,#10:7],owner:#5:0,parent:#9:0,created:1356998400000t";
+static const char *doc_nested = "Doc@title:\"nested\",tags:[\"a\",\"b\",\"c\"],"
+  "attrs:{\"k1\":\"v1\",\"k2\":2,\"k3\":[1,2,3]},links:[#1:1,#1:2],"
+  "nums:[1,2,3,4,5,6,7,8,9,10]";
+
+namespace OrientPP {
+
+class orientbench {
+  double min_time;
+  string filter;
+  orientsrv srv;
+  orientdb db;
+  orientsession session;
+  string wide_doc;
+  // bytes handed to the parser as if they were received from the socket
+  void feed(const string &data) {
+    size_t n = boost::asio::buffer_copy(srv.tc.buf_.prepare(data.size()), boost::asio::buffer(data));
+    srv.tc.buf_.commit(n);
+  }
+  static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+  }
+  void run(const string &name, boost::function<void ()> op) {
+    if (filter.size() && (name.find(filter) == string::npos))
+      return;
+    op(); // warm up
+    u64 n = 1;
+    double elapsed;
+    u64 a, b;
+    for (;;) {
+      a = allocs;
+      b = alloc_bytes;
+      double start = now();
+      for (u64 i = 0; i < n; i++)
+        op();
+      elapsed = now() - start;
+      if ((elapsed >= min_time) || (n >= (u64(1) << 40)))
+        break;
+      // aim a bit past the minimal time
+      n = (elapsed > 0) ? u64(n * 1.2 * min_time / elapsed) + 1 : n * 10;
+    }
+    printf("%-32s %12llu %12.1f %12.2f %12.1f\n", name.c_str(), (unsigned long long)n,
+      elapsed * 1e9 / n, double(allocs - a) / n, double(alloc_bytes - b) / n);
+  }
+  // (status:byte)(session-id:int)(payload-status:byte)...
+  static void header(orientsrv_buf &r) {
+    r.append((u8)0);
+    r.append((s32)1);
+  }
+  static void record(orientsrv_buf &r, s64 pos, const string &content) {
+    r.append((u16)0);
+    r.append((u8)ORIENT_DOCUMENT_RECORD);
+    r.append((u16)9);
+    r.append(pos);
+    r.append((s32)1);
+    r.append(content);
+  }
+  void encode_command(orientquery *q, orientsrv_buf *req) {
+    req->clear();
+    q->encode(*req, AS_SQL);
+  }
+  void encode_prepared(orientquery *q, orientsrv_buf *req, int *i) {
+    q->set(0, (*i)++);
+    req->clear();
+    q->encode(*req, AS_SQL);
+  }
+  void encode_open() {
+    orientsrv_buf r(ORIENTPP_DRIVER_NAME);
+    r.append(ORIENTPP_DRIVER_VERSION);
+    r.append((u16)ORIENTPP_DRIVER_PROTO_VERSION);
+    r.append("1");
+    r.append("db");
+    r.append("graph");
+    r.append("admin");
+    r.append("admin");
+  }
+  void decode_fields(const string *data) {
+    feed(*data);
+    orientrsp rsp(&srv.tc, &session);
+    u8 b;
+    u16 s;
+    s32 i;
+    s64 l;
+    string str;
+    rsp.parse(&b);
+    rsp.parse(&s);
+    rsp.parse(&i);
+    rsp.parse(&l);
+    rsp.parse(&str);
+  }
+  void decode_collection(orientquery *q, const string *data, bool zero_copy) {
+    feed(*data);
+    orientrsp rsp(&srv.tc, &session);
+    orientresult result(zero_copy);
+    rsp.check_result();
+    q->parse_result(rsp, &result);
+  }
+  static void parse_record(const orient_record_t *proto) {
+    orient_record_t r(*proto);
+    r.parse();
+  }
+  static void parse_projection(const orient_record_t *proto, const vector<string> *fields) {
+    orient_record_t r(*proto);
+    r.parse(*fields);
+  }
+  static void parse_read(const orient_record_t *proto) {
+    orient_record_t r(*proto);
+    s64 sum = 0;
+    for (int i = 0; i < 50; i += 10)
+      sum += r.get_property("f" + itoa(i)).as_long();
+    if (sum < 0)
+      throw Exception("orientbench: bad sum");
+  }
+  static void json_record(orient_record_t *r) {
+    json_spirit::wmObject obj;
+    json_add_str(obj, "oid", string(r->rid));
+    for (property_iterator it = r->properties.begin(); it != r->properties.end(); it++) {
+      property_t p = it->second;
+      json_add_str(obj, p.name, string(p));
+    }
+    json_write(obj);
+  }
+ public:
+  orientbench(double t, const string &f) : min_time(t), filter(f), db(srv) {
+    // 50 fields, a typical wide row where only a few columns are read
+    wide_doc = "Row@";
+    for (int i = 0; i < 50; i++) {
+      if (i)
+        wide_doc += ",";
+      wide_doc += "f" + itoa(i) + ":";
+      if (i % 10)
+        wide_doc += "\"value of the field " + itoa(i) + "\"";
+      else
+        wide_doc += itoa(i * 1000);
+    }
+  }
+  void run_all() {
+    printf("%-32s %12s %12s %12s %12s\n", "benchmark", "iterations", "ns/op", "allocs/op",
+      "bytes/op");
+    orientsrv_buf req;
+    orientquery q(db);
+    q << "select from V where name = 'node 17' and out.size() > 2 limit 10";
+    q.text(q.buf.str());
+    q.buf.str("");
+    run("encode/command", boost::bind(&orientbench::encode_command, this, &q, &req));
+    orientquery pq(db);
+    pq << "select from V where n = ?";
+    int n = 0;
+    pq.set(0, n);
+    run("encode/prepared", boost::bind(&orientbench::encode_prepared, this, &pq, &req, &n));
+    run("encode/db_open", boost::bind(&orientbench::encode_open, this));
+
+    orientsrv_buf fields;
+    header(fields);
+    fields.append((u8)1);
+    fields.append((u16)2);
+    fields.append((s32)3);
+    fields.append((s64)4);
+    fields.append("a string field");
+    run("decode/fields", boost::bind(&orientbench::decode_fields, this, &fields.data));
+
+    const char *docs[] = { doc_simple, doc_links, doc_nested };
+    orientsrv_buf coll;
+    header(coll);
+    coll.append((u8)'l');
+    coll.append((s32)100);
+    for (int i = 0; i < 100; i++)
+      record(coll, i, docs[i % 3]);
+    orientquery cq(db);
+    run("decode/collection_100", boost::bind(&orientbench::decode_collection, this, &cq,
+      &coll.data, false));
+    run("decode/collection_100_zero_copy", boost::bind(&orientbench::decode_collection, this, &cq,
+      &coll.data, true));
+
+    const char *names[] = { "simple", "links", "nested" };
+    for (int i = 0; i < 3; i++) {
+      orient_record_t *r = new orient_record_t(ORIENT_DOCUMENT_RECORD, 9, 1, 1, orientbytes(docs[i]));
+      run(string("record/parse_") + names[i], boost::bind(&orientbench::parse_record, r));
+      delete r;
+    }
+    orient_record_t wide(ORIENT_DOCUMENT_RECORD, 9, 1, 1, orientbytes(wide_doc));
+    run("record/parse_wide_50", boost::bind(&orientbench::parse_record, &wide));
+    vector <string> proj;
+    proj.push_back("f10");
+    proj.push_back("f40");
+    run("record/projection_2_of_50", boost::bind(&orientbench::parse_projection, &wide, &proj));
+    run("record/typed_reads_5_of_50", boost::bind(&orientbench::parse_read, &wide));
+
+    orient_record_t js(ORIENT_DOCUMENT_RECORD, 9, 1, 1, orientbytes(doc_simple));
+    js.parse();
+    run("json/write_simple", boost::bind(&orientbench::json_record, &js));
+  }
+};
+
+}
+
+int main(int argc, char **argv)
+{
+ double t = 0.5;
+ string filter;
+ for (int i = 1; i < argc; i++)
+   if (!strcmp(argv[i], "-t") && ((i + 1) < argc))
+     t = atof(argv[++i]);
+   else
+     filter = argv[i];
+ try {
+   orientbench(t, filter).run_all();
+ }
+ catch (std::exception &e) {
+   fprintf(stderr, "orientbench: %s\n", e.what());
+   return 1;
+ }
+ return 0;
+}
@@ -0,0 +1,108 @@
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+#include "db.h"
+
+namespace OrientPP {
+
+orientcache::orientcache(size_t capacity, size_t n_shards)
+{
+ if (!n_shards)
+   n_shards = 1;
+ shard_capacity = (capacity + n_shards - 1) / n_shards;
+ if (!shard_capacity)
+   throw Exception("orientcache: capacity must be positive");
+ for (size_t i = 0; i < n_shards; i++)
+   shards.push_back(boost::shared_ptr<shard>(new shard));
+}
+
+bool orientcache::get(const rid_t &rid, orient_record_t &r)
+{
+ shard &s = shard_of(rid);
+ boost::unique_lock<boost::mutex> lock(s.m_lock);
+ boost::unordered_map<rid_t, lru_t::iterator, rid_hash>::iterator it = s.index.find(rid);
+ if (it == s.index.end()) {
+   s.misses++;
+   return false;
+ }
+ s.lru.splice(s.lru.begin(), s.lru, it->second);
+ r = *it->second;
+ s.hits++;
+ return true;
+}
+
+void orientcache::put(const orient_record_t &r)
+{
+ if (!r.rid.valid || r.rid.is_temporary() || (r.type == ORIENT_NULL_RECORD) ||
+   (r.type == ORIENT_RECORD_ID))
+     return;
+ // own copy of the content, a zero copy record would pin the whole chunk of its result
+ orient_record_t c(r.type, r.rid.id, r.rid.pos, r.version, orientbytes(r.content.str()));
+ shard &s = shard_of(r.rid);
+ boost::unique_lock<boost::mutex> lock(s.m_lock);
+ boost::unordered_map<rid_t, lru_t::iterator, rid_hash>::iterator it = s.index.find(r.rid);
+ if (it != s.index.end()) {
+   if (it->second->version > r.version)
+     return;
+   *it->second = c;
+   s.lru.splice(s.lru.begin(), s.lru, it->second);
+   return;
+ }
+ s.lru.push_front(c);
+ s.index[r.rid] = s.lru.begin();
+ if (s.lru.size() > shard_capacity) {
+   s.index.erase(s.lru.back().rid);
+   s.lru.pop_back();
+ }
+}
+
+void orientcache::invalidate(const rid_t &rid)
+{
+ shard &s = shard_of(rid);
+ boost::unique_lock<boost::mutex> lock(s.m_lock);
+ boost::unordered_map<rid_t, lru_t::iterator, rid_hash>::iterator it = s.index.find(rid);
+ if (it == s.index.end())
+   return;
+ s.lru.erase(it->second);
+ s.index.erase(it);
+}
+
+void orientcache::clear()
+{
+ for (size_t i = 0; i < shards.size(); i++) {
+   boost::unique_lock<boost::mutex> lock(shards[i]->m_lock);
+   shards[i]->lru.clear();
+   shards[i]->index.clear();
+ }
+}
+
+u64 orientcache::hits()
+{
+ u64 n = 0;
+ for (size_t i = 0; i < shards.size(); i++) {
+   boost::unique_lock<boost::mutex> lock(shards[i]->m_lock);
+   n += shards[i]->hits;
+ }
+ return n;
+}
+
+u64 orientcache::misses()
+{
+ u64 n = 0;
+ for (size_t i = 0; i < shards.size(); i++) {
+   boost::unique_lock<boost::mutex> lock(shards[i]->m_lock);
+   n += shards[i]->misses;
+ }
+ return n;
+}
+
+size_t orientcache::size()
+{
+ size_t n = 0;
+ for (size_t i = 0; i < shards.size(); i++) {
+   boost::unique_lock<boost::mutex> lock(shards[i]->m_lock);
+   n += shards[i]->lru.size();
+ }
+ return n;
+}
+
+};
@@ -0,0 +1,53 @@
+
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+#ifndef _ORIENTPP_CACHE_H_
+#define _ORIENTPP_CACHE_H_
+
+#include <list>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace OrientPP {
+
+enum {
+  ORIENTPP_DEFAULT_CACHE_SIZE = 16384,
+  ORIENTPP_DEFAULT_CACHE_SHARDS = 16
+};
+
+struct rid_hash {
+  size_t operator()(const rid_t &r) const { return (size_t)(r.pos * 31 + r.id); }
+};
+
+// bounded LRU of records by rid, may be shared by several connections (see orientpool_config),
+// every shard has its own lock
+class orientcache {
+  typedef list <orient_record_t> lru_t;
+  struct shard {
+    boost::mutex m_lock;
+    lru_t lru; // most recently used first
+    boost::unordered_map<rid_t, lru_t::iterator, rid_hash> index;
+    u64 hits, misses;
+    shard() : hits(0), misses(0) { }
+  };
+  vector <boost::shared_ptr<shard> > shards;
+  size_t shard_capacity;
+  shard &shard_of(const rid_t &r) { return *shards[rid_hash()(r) % shards.size()]; }
+  orientcache& operator= (const orientcache&) = delete;
+  orientcache(const orientcache &)  = delete;
+ public:
+  orientcache(size_t capacity = ORIENTPP_DEFAULT_CACHE_SIZE,
+    size_t n_shards = ORIENTPP_DEFAULT_CACHE_SHARDS);
+  bool get(const rid_t &rid, orient_record_t &r);
+  // keeps the cached copy if it is newer
+  void put(const orient_record_t &r);
+  void invalidate(const rid_t &rid);
+  void clear();
+  size_t size();
+  u64 hits();
+  u64 misses();
+};
+
+}; // namespace
+
+#endif
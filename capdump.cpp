@@ -0,0 +1,111 @@
+
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+// Prints a wire capture file written by orientcapture (see capture.h)
+// usage: capdump [-h] file
+//   -h  frame headers only, no hex dump
+
+#include <ctime>
+#include "db.h"
+
+using namespace OrientPP;
+
+static const char *command_name(int cmd)
+{
+#define ORIENTPP_COMMAND(c) case ORIENTDB_##c: return #c;
+ switch (cmd) {
+   ORIENTPP_COMMAND(SHUTDOWN)
+   ORIENTPP_COMMAND(CONNECT)
+   ORIENTPP_COMMAND(DB_OPEN)
+   ORIENTPP_COMMAND(DB_CREATE)
+   ORIENTPP_COMMAND(DB_CLOSE)
+   ORIENTPP_COMMAND(DB_EXIST)
+   ORIENTPP_COMMAND(DB_DELETE)
+   ORIENTPP_COMMAND(DB_SIZE)
+   ORIENTPP_COMMAND(DB_COUNTRECORDS)
+   ORIENTPP_COMMAND(DATACLUSTER_ADD)
+   ORIENTPP_COMMAND(DATACLUSTER_REMOVE)
+   ORIENTPP_COMMAND(DATACLUSTER_COUNT)
+   ORIENTPP_COMMAND(DATACLUSTER_DATARANGE)
+   ORIENTPP_COMMAND(DATASEGMENT_ADD)
+   ORIENTPP_COMMAND(DATASEGMENT_REMOVE)
+   ORIENTPP_COMMAND(RECORD_LOAD)
+   ORIENTPP_COMMAND(RECORD_CREATE)
+   ORIENTPP_COMMAND(RECORD_UPDATE)
+   ORIENTPP_COMMAND(RECORD_DELETE)
+   ORIENTPP_COMMAND(COUNT)
+   ORIENTPP_COMMAND(COMMAND)
+   ORIENTPP_COMMAND(TX_COMMIT)
+   ORIENTPP_COMMAND(CONFIG_GET)
+   ORIENTPP_COMMAND(CONFIG_SET)
+   ORIENTPP_COMMAND(CONFIG_LIST)
+   ORIENTPP_COMMAND(DB_RELOAD)
+ }
+#undef ORIENTPP_COMMAND
+ return "?";
+}
+
+static void hexdump(const string &s)
+{
+ const unsigned char *d = (const unsigned char *)s.data();
+ for (size_t off = 0; off < s.size(); off += 16) {
+   printf("  %06zx ", off);
+   for (size_t i = off; i < off + 16; i++)
+     if (i < s.size())
+       printf(" %02x", d[i]);
+     else
+       printf("   ");
+   printf("  ");
+   for (size_t i = off; (i < off + 16) && (i < s.size()); i++)
+     putchar(((d[i] >= 0x20) && (d[i] < 0x7f)) ? d[i] : '.');
+   putchar('\n');
+ }
+}
+
+int main(int argc, char **argv)
+{
+ bool dump = true;
+ int a = 1;
+ if ((argc > 2) && !strcmp(argv[1], "-h")) {
+   dump = false;
+   a++;
+ }
+ if (a != (argc - 1)) {
+   fprintf(stderr, "usage: %s [-h] capture-file\n", argv[0]);
+   return 1;
+ }
+ u64 first = 0, frames = 0, bytes = 0;
+ map <u32, bool> parted; // connection -> inside a response recorded in pieces
+ try {
+   orientcapture_reader f(argv[a]);
+   orientcapture_frame fr;
+   while (f.next(fr)) {
+     if (!frames)
+       first = fr.usec;
+     time_t sec = fr.usec / 1000000;
+     char ts[32];
+     strftime(ts, sizeof(ts), "%H:%M:%S", localtime(&sec));
+     printf("%s.%06u +%.6f conn %u session %d %s %zu bytes", ts, unsigned(fr.usec % 1000000),
+       (fr.usec - first) / 1e6, fr.conn, fr.session_id,
+       (fr.dir == ORIENTPP_CAPTURE_WRITE) ? "->" : "<-", fr.data.size());
+     if (fr.data.size() && (fr.dir == ORIENTPP_CAPTURE_WRITE))
+       printf(" %s", command_name(u8(fr.data[0])));
+     else if (!parted[fr.conn] && (fr.data.size() > 4))
+       printf(" status %d", int(fr.data[0]));
+     if (fr.dir == ORIENTPP_CAPTURE_READ_PART)
+       printf(" (more follows)");
+     parted[fr.conn] = (fr.dir == ORIENTPP_CAPTURE_READ_PART);
+     putchar('\n');
+     if (dump)
+       hexdump(fr.data);
+     frames++;
+     bytes += fr.data.size();
+   }
+ }
+ catch (std::exception &e) {
+   fprintf(stderr, "capdump: %s\n", e.what());
+   return 1;
+ }
+ printf("%llu frames, %llu bytes\n", (unsigned long long)frames, (unsigned long long)bytes);
+ return 0;
+}
@@ -0,0 +1,126 @@
+
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+#include "db.h"
+#include <sys/time.h>
+
+namespace OrientPP {
+
+boost::atomic<orientcapture *> orientcapture::global_(0);
+
+orientcapture::orientcapture(const string &file) : writing(false), stopping(false), next_conn(0)
+{
+ f = fopen(file.c_str(), "wb");
+ if (!f)
+   throw Exception("orientcapture: Can't create " + file + ": " + strerror(errno));
+ fwrite(ORIENTPP_CAPTURE_MAGIC, 1, 8, f);
+ writer = boost::thread(boost::bind(&orientcapture::run, this));
+}
+
+orientcapture::~orientcapture()
+{
+ {
+   boost::mutex::scoped_lock lock(m);
+   stopping = true;
+ }
+ cv.notify_one();
+ writer.join();
+ orientcapture *self = this;
+ global_.compare_exchange_strong(self, 0);
+ fclose(f);
+}
+
+void orientcapture::record(u32 conn, s32 session_id, u8 dir, const char *data, size_t len)
+{
+ struct timeval tv;
+ gettimeofday(&tv, 0);
+ u64 usec = u64(tv.tv_sec) * 1000000 + tv.tv_usec;
+ char hdr[ORIENTPP_CAPTURE_HEADER_SIZE];
+ u32 hi = htonl(u32(usec >> 32)), lo = htonl(u32(usec)), c = htonl(conn),
+   sid = htonl(u32(session_id)), l = htonl(u32(len));
+ memcpy(hdr, &hi, 4);
+ memcpy(hdr + 4, &lo, 4);
+ memcpy(hdr + 8, &c, 4);
+ memcpy(hdr + 12, &sid, 4);
+ hdr[16] = dir;
+ memcpy(hdr + 17, &l, 4);
+ boost::mutex::scoped_lock lock(m);
+ while (!stopping && (pending.size() > ORIENTPP_CAPTURE_MAX_BUFFER))
+   space.wait(lock);
+ pending.append(hdr, sizeof(hdr));
+ pending.append(data, len);
+ if (pending.size() > ORIENTPP_CAPTURE_BUFFER)
+   cv.notify_one();
+}
+
+void orientcapture::flush()
+{
+ boost::mutex::scoped_lock lock(m);
+ while (pending.size() || writing) {
+   cv.notify_one();
+   space.wait(lock);
+ }
+}
+
+void orientcapture::run()
+{
+ boost::mutex::scoped_lock lock(m);
+ for (;;) {
+   if (!pending.size()) {
+     if (stopping)
+       break;
+     cv.timed_wait(lock, boost::posix_time::milliseconds(int(ORIENTPP_CAPTURE_FLUSH_INTERVAL)));
+     continue;
+   }
+   out.swap(pending);
+   writing = true;
+   lock.unlock();
+   fwrite(out.data(), 1, out.size(), f);
+   fflush(f);
+   if (out.capacity() > ORIENTPP_CAPTURE_MAX_BUFFER)
+     string().swap(out);
+   else
+     out.clear();
+   lock.lock();
+   writing = false;
+   space.notify_all();
+ }
+}
+
+orientcapture_reader::orientcapture_reader(const string &file_) : file(file_)
+{
+ f = fopen(file.c_str(), "rb");
+ if (!f)
+   throw Exception("orientcapture: Can't open " + file + ": " + strerror(errno));
+ char magic[8];
+ if ((fread(magic, 1, 8, f) != 8) || memcmp(magic, ORIENTPP_CAPTURE_MAGIC, 8)) {
+   fclose(f);
+   throw Exception("orientcapture: " + file + " is not a capture file");
+ }
+}
+
+bool orientcapture_reader::next(orientcapture_frame &fr)
+{
+ char hdr[ORIENTPP_CAPTURE_HEADER_SIZE];
+ size_t n = fread(hdr, 1, sizeof(hdr), f);
+ if (!n)
+   return false;
+ if (n != sizeof(hdr))
+   throw Exception("orientcapture: Truncated record header in " + file);
+ u32 hi, lo, c, sid, l;
+ memcpy(&hi, hdr, 4);
+ memcpy(&lo, hdr + 4, 4);
+ memcpy(&c, hdr + 8, 4);
+ memcpy(&sid, hdr + 12, 4);
+ memcpy(&l, hdr + 17, 4);
+ fr.usec = (u64(ntohl(hi)) << 32) | ntohl(lo);
+ fr.conn = ntohl(c);
+ fr.session_id = s32(ntohl(sid));
+ fr.dir = hdr[16];
+ fr.data.resize(ntohl(l));
+ if (fr.data.size() && (fread(&fr.data[0], 1, fr.data.size(), f) != fr.data.size()))
+   throw Exception("orientcapture: Truncated record in " + file);
+ return true;
+}
+
+}
@@ -0,0 +1,84 @@
+
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+#ifndef _ORIENTPP_CAPTURE_H_
+#define _ORIENTPP_CAPTURE_H_
+
+#include <cstdio>
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace OrientPP {
+
+// capture file: (magic:8 bytes)[record]*
+// record: (time-usec:long)(connection:int)(session-id:int)(direction:byte)(length:int)(bytes)
+// integers in network byte order, session-id is -1 when the frame does not carry one,
+// a long response is recorded in pieces as it is read, capdump prints the file
+#define ORIENTPP_CAPTURE_MAGIC		"ORPPCAP1"
+
+enum {
+  ORIENTPP_CAPTURE_WRITE = 'W',  // one request (or a pipelined batch of them) as written
+  ORIENTPP_CAPTURE_READ = 'R',   // one response as parsed, or the last piece of a long one
+  ORIENTPP_CAPTURE_READ_PART = 'r', // piece of a long response, the rest follows
+  ORIENTPP_CAPTURE_HEADER_SIZE = 8 + 4 + 4 + 1 + 4,
+  ORIENTPP_CAPTURE_BUFFER = 1024 * 1024,
+  // callers wait for the writer above this
+  ORIENTPP_CAPTURE_MAX_BUFFER = 8 * ORIENTPP_CAPTURE_BUFFER,
+  ORIENTPP_CAPTURE_FLUSH_INTERVAL = 100 // ms
+};
+
+// one record of the capture file
+struct orientcapture_frame {
+  u64 usec;
+  u32 conn;
+  s32 session_id;
+  u8 dir;
+  string data;
+};
+
+// raw wire bytes of all the connections appended to one file by a background writer
+class orientcapture {
+  boost::mutex m;
+  boost::condition_variable cv, space;
+  string pending;               // filled by the connections
+  string out;                   // being written, writer only
+  FILE *f;
+  bool writing, stopping;
+  boost::atomic<u32> next_conn;
+  boost::thread writer;
+  static boost::atomic<orientcapture *> global_;
+  void run();
+  orientcapture& operator= (const orientcapture&) = delete;
+  orientcapture(const orientcapture &)  = delete;
+ public:
+  orientcapture(const string &file);
+  ~orientcapture();
+  u32 connection() { return ++next_conn; }
+  void record(u32 conn, s32 session_id, u8 dir, const char *data, size_t len);
+  // waits until everything recorded so far is in the file
+  void flush();
+  // picked up by the connections created after the call, 0 - none. The connections keep
+  // a plain pointer: the capture must outlive all of them, not only the global() setting
+  static void global(orientcapture *c) { global_ = c; }
+  static orientcapture *global() { return global_; }
+};
+
+// reads the records of a capture file back in order
+class orientcapture_reader {
+  FILE *f;
+  string file;
+  orientcapture_reader& operator= (const orientcapture_reader&) = delete;
+  orientcapture_reader(const orientcapture_reader &)  = delete;
+ public:
+  orientcapture_reader(const string &file_);
+  ~orientcapture_reader() { fclose(f); }
+  // false at the end of the file
+  bool next(orientcapture_frame &fr);
+};
+
+}
+
+#endif
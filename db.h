@@ -38,6 +38,9 @@ string time_str(time_t now = time(0));
 }; // namespace
 
 #include "orient.h"
+#include "cache.h"
+#include "pool.h"
+#include "mock.h"
 #include "json.h"
 
 #endif 
@@ -0,0 +1,279 @@
+
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+// End to end load generator: N threads run a mix of operations over M pooled connections
+// and report throughput and latency percentiles per operation, see orientload --help
+
+#include <time.h>
+#include <boost/program_options.hpp>
+#include "db.h"
+
+using namespace OrientPP;
+namespace po = boost::program_options;
+
+// log-linear histogram of usec latencies, 32 buckets per power of two (~3% error)
+class latency_histogram {
+  enum { SUB_BITS = 5, SUB = 1 << SUB_BITS };
+  vector <u64> counts;
+  u64 n, sum, max_;
+  static size_t bucket(u64 v) {
+    if (v < SUB)
+      return v;
+    int e = 63 - __builtin_clzll(v);
+    return (e - SUB_BITS + 1) * SUB + ((v >> (e - SUB_BITS)) & (SUB - 1));
+  }
+  // highest value of the bucket
+  static u64 upper(size_t b) {
+    if (b < SUB)
+      return b;
+    int e = b / SUB + SUB_BITS - 1;
+    return ((u64(SUB + b % SUB) + 1) << (e - SUB_BITS)) - 1;
+  }
+ public:
+  latency_histogram() : counts(bucket(~u64(0)) + 1), n(0), sum(0), max_(0) { }
+  void add(u64 usec) {
+    counts[bucket(usec)]++;
+    n++;
+    sum += usec;
+    if (usec > max_)
+      max_ = usec;
+  }
+  void merge(const latency_histogram &h) {
+    for (size_t i = 0; i < counts.size(); i++)
+      counts[i] += h.counts[i];
+    n += h.n;
+    sum += h.sum;
+    if (h.max_ > max_)
+      max_ = h.max_;
+  }
+  u64 count() const { return n; }
+  u64 max() const { return max_; }
+  double mean() const { return n ? double(sum) / n : 0; }
+  u64 percentile(double p) const {
+    u64 target = u64(p * n + 0.5), seen = 0;
+    if (!target)
+      target = 1;
+    for (size_t i = 0; i < counts.size(); i++) {
+      seen += counts[i];
+      if (seen >= target)
+        return min(upper(i), max_);
+    }
+    return max_;
+  }
+};
+
+enum {
+  OP_SELECT,
+  OP_INSERT,
+  OP_TRAVERSE,
+  OP_LOAD,
+  OP_MAX
+};
+
+static const char *op_names[OP_MAX] = { "select", "insert", "traverse", "load" };
+
+struct load_stats {
+  latency_histogram lat[OP_MAX];
+  u64 errors[OP_MAX];
+  string last_error;
+  load_stats() { memset(errors, 0, sizeof(errors)); }
+};
+
+class orientload {
+  orientpool &pool;
+  vector <int> mix;            // op weights
+  int weight_total;
+  u64 records;                 // point operations pick positions below this
+  s16 vertex_cluster;
+  boost::atomic<bool> stop;
+  boost::atomic<u64> seq;
+  vector <load_stats> stats;
+  static u64 usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return u64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+  }
+  // same calls the applications make: checkout, query, release
+  void op(int type, unsigned int *rnd) {
+    orientpool::session s = pool.checkout();
+    s64 pos = rand_r(rnd) % records;
+    switch (type) {
+      case OP_SELECT: {
+        orientquery q(*s, "select from V where n = ?");
+        q.set(0, pos);
+        q.execute(AS_SQL);
+        break;
+      }
+      case OP_INSERT: {
+        orientquery q(*s);
+        q << "create vertex V set n = " << s64(records + seq++) << ", name = 'load'";
+        q.execute(AS_SQL);
+        break;
+      }
+      case OP_TRAVERSE: {
+        // like dump_tree() in test.cpp
+        orientquery q(*s);
+        q << "traverse V.in, E.out from " << string(rid_t(vertex_cluster, pos));
+        q.execute(AS_SQL);
+        break;
+      }
+      case OP_LOAD:
+        s->load(rid_t(vertex_cluster, pos));
+        break;
+    }
+  }
+  void worker(size_t n) {
+    load_stats &st = stats[n];
+    unsigned int rnd = n * 7919 + time(0);
+    while (!stop) {
+      int w = rand_r(&rnd) % weight_total, type = 0;
+      while (w >= mix[type])
+        w -= mix[type++];
+      u64 start = usec();
+      try {
+        op(type, &rnd);
+      }
+      catch (std::exception &e) {
+        st.errors[type]++;
+        st.last_error = e.what();
+        continue;
+      }
+      st.lat[type].add(usec() - start);
+    }
+  }
+ public:
+  orientload(orientpool &p, const vector <int> &mix_, u64 records_) : pool(p), mix(mix_),
+    weight_total(0), records(records_ ? records_ : 1), stop(false), seq(0) {
+    for (size_t i = 0; i < mix.size(); i++)
+      weight_total += mix[i];
+    if (!weight_total)
+      throw Exception("orientload: Empty operation mix");
+    orientpool::session s = pool.checkout();
+    vertex_cluster = s->cluster_id("V");
+    if (vertex_cluster < 0)
+      throw Exception("orientload: No V cluster");
+  }
+  void run(size_t threads, int seconds) {
+    stats.resize(threads);
+    boost::thread_group workers;
+    u64 start = usec();
+    for (size_t i = 0; i < threads; i++)
+      workers.create_thread(boost::bind(&orientload::worker, this, i));
+    boost::this_thread::sleep(boost::posix_time::seconds(seconds));
+    stop = true;
+    workers.join_all();
+    report(double(usec() - start) / 1e6);
+  }
+  void report(double elapsed) {
+    printf("%-10s %10s %8s %10s %9s %9s %9s %9s %9s\n", "op", "count", "errors", "ops/s",
+      "mean", "p50", "p99", "p999", "max");
+    latency_histogram all;
+    u64 all_errors = 0;
+    string last_error;
+    for (int t = 0; t < OP_MAX; t++) {
+      latency_histogram h;
+      u64 errors = 0;
+      for (size_t i = 0; i < stats.size(); i++) {
+        h.merge(stats[i].lat[t]);
+        errors += stats[i].errors[t];
+        if (stats[i].last_error.size())
+          last_error = stats[i].last_error;
+      }
+      if (!mix[t])
+        continue;
+      print(op_names[t], h, errors, elapsed);
+      all.merge(h);
+      all_errors += errors;
+    }
+    print("total", all, all_errors, elapsed);
+    printf("latencies in usec, %.1f s\n", elapsed);
+    if (last_error.size())
+      printf("last error: %s\n", last_error.c_str());
+  }
+  static void print(const char *name, const latency_histogram &h, u64 errors, double elapsed) {
+    printf("%-10s %10llu %8llu %10.0f %9.0f %9llu %9llu %9llu %9llu\n", name,
+      (unsigned long long)h.count(), (unsigned long long)errors, h.count() / elapsed, h.mean(),
+      (unsigned long long)h.percentile(0.5), (unsigned long long)h.percentile(0.99),
+      (unsigned long long)h.percentile(0.999), (unsigned long long)h.max());
+  }
+};
+
+// select=70,insert=10,...
+static vector <int> parse_mix(const string &s)
+{
+ vector <int> mix(OP_MAX, 0);
+ size_t pos = 0;
+ while (pos < s.size()) {
+   size_t end = s.find(',', pos);
+   if (end == string::npos)
+     end = s.size();
+   string item = s.substr(pos, end - pos);
+   size_t eq = item.find('=');
+   int t = 0;
+   while ((t < OP_MAX) && (item.substr(0, eq) != op_names[t]))
+     t++;
+   if ((t == OP_MAX) || (eq == string::npos))
+     throw Exception("orientload: Bad mix item: " + item);
+   mix[t] = atoi(item.c_str() + eq + 1);
+   pos = end + 1;
+ }
+ return mix;
+}
+
+int main(int argc, char **argv)
+{
+ po::options_description desc("orientload options");
+ desc.add_options()
+   ("help,h", "this help")
+   ("url,u", po::value<string>()->default_value("localhost"), "server host[:port]")
+   ("db", po::value<string>()->default_value("sfinx"), "database")
+   ("user", po::value<string>()->default_value("admin"), "database user")
+   ("pass", po::value<string>()->default_value("admin"), "database password")
+   ("threads,t", po::value<size_t>()->default_value(8), "worker threads")
+   ("connections,c", po::value<size_t>()->default_value(4), "pooled connections")
+   ("duration,d", po::value<int>()->default_value(10), "seconds to run")
+   ("mix,m", po::value<string>()->default_value("select=70,insert=10,traverse=10,load=10"),
+     "operation weights")
+   ("records,r", po::value<u64>()->default_value(1000), "positions picked by point operations")
+   ("mock", "run against the in-process mock server instead of --url")
+   ("latency,l", po::value<int>()->default_value(0), "mock server latency, usec");
+ po::variables_map vm;
+ try {
+   po::store(po::parse_command_line(argc, argv, desc), vm);
+   po::notify(vm);
+ }
+ catch (std::exception &e) {
+   fprintf(stderr, "orientload: %s\n", e.what());
+   return 1;
+ }
+ if (vm.count("help")) {
+   cout << desc << endl;
+   return 0;
+ }
+ try {
+   boost::shared_ptr<orientmock> mock;
+   string url = vm["url"].as<string>();
+   if (vm.count("mock")) {
+     orientmock_config mc;
+     mc.latency = vm["latency"].as<int>();
+     mc.cluster_records = vm["records"].as<u64>();
+     mc.result_size = 1;
+     mock.reset(new orientmock(mc));
+     url = mock->url();
+   }
+   orientpool_config cfg(url, vm["db"].as<string>(), vm["user"].as<string>(),
+     vm["pass"].as<string>());
+   cfg.min_size = cfg.max_size = vm["connections"].as<size_t>();
+   orientpool pool(cfg);
+   orientload load(pool, parse_mix(vm["mix"].as<string>()), vm["records"].as<u64>());
+   printf("orientload: %s, %zu threads, %zu connections, %d s, mix %s\n", url.c_str(),
+     vm["threads"].as<size_t>(), cfg.max_size, vm["duration"].as<int>(),
+     vm["mix"].as<string>().c_str());
+   load.run(vm["threads"].as<size_t>(), vm["duration"].as<int>());
+ }
+ catch (std::exception &e) {
+   fprintf(stderr, "orientload: %s\n", e.what());
+   return 1;
+ }
+ return 0;
+}
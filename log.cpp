@@ -3,6 +3,10 @@
 
 #include "db.h"
 #include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <boost/atomic.hpp>
+#include <boost/thread/tss.hpp>
 
 string OrientPP::time_str(time_t now)
 {
@@ -13,17 +17,205 @@ string OrientPP::time_str(time_t now)
 
 OrientPP::debug_t OrientPP::debug;
 
+namespace {
+
+using namespace OrientPP;
+
+struct log_line {
+  u64 seq;
+  time_t t;
+  int level;
+  string msg;
+  bool operator<(const log_line &l) const { return seq < l.seq; }
+};
+
+// single producer (the owning thread) / single consumer (whoever holds debug.m)
+struct log_ring {
+  vector <log_line> slots;
+  boost::atomic<size_t> head, tail;
+  boost::atomic<bool> orphan;
+  log_ring(size_t size) : slots(size), head(0), tail(0), orphan(false) { }
+};
+
+typedef boost::shared_ptr<log_ring> log_ring_ptr;
+
+void release_ring(log_ring_ptr *r)
+{
+ (*r)->orphan = true;
+ delete r;
+}
+
+void stop_writer();
+
+class log_writer {
+  boost::mutex m;
+  boost::condition_variable cv;
+  vector <log_ring_ptr> rings;
+  boost::thread_specific_ptr<log_ring_ptr> local;
+  boost::atomic<u64> seq;
+  boost::atomic<bool> stopped;
+  bool stopping;
+  boost::thread flusher;
+  // sinks, touched with debug.m held
+  ofstream flog;
+  string flog_name;
+  time_t last_t;
+  string last_ts;
+  log_ring *ring() {
+    log_ring_ptr *r = local.get();
+    if (!r) {
+      r = new log_ring_ptr(new log_ring(ORIENTPP_DEFAULT_LOG_RING_SIZE));
+      local.reset(r);
+      boost::mutex::scoped_lock lock(m);
+      rings.push_back(*r);
+    }
+    return r->get();
+  }
+  void wake() { cv.notify_one(); }
+  void run() {
+    boost::mutex::scoped_lock lock(m);
+    while (!stopping) {
+      cv.timed_wait(lock, boost::posix_time::milliseconds(ORIENTPP_DEFAULT_LOG_FLUSH_INTERVAL));
+      lock.unlock();
+      drain();
+      lock.lock();
+    }
+  }
+  void write(const log_line &l) {
+    if (l.t != last_t) {
+      last_t = l.t;
+      last_ts = time_str(l.t);
+    }
+    static const char *tags[] = { "ERROR: ", "WARN: ", "", "DEBUG: ", "TRACE: " };
+    const char *tag = ((l.level >= LOG_ERROR) && (l.level <= LOG_TRACE)) ? tags[l.level] : "";
+    if (debug.log_to_stdout)
+      cout << "[" << last_ts << "] " << tag << l.msg << "\n";
+    if (debug.log_to_file) {
+      if (!flog.is_open() || (flog_name != debug.log_file)) {
+        if (flog.is_open())
+          flog.close();
+        flog_name = debug.log_file;
+        flog.open(flog_name.c_str(), ios::app);
+      }
+      flog << "[" << last_ts << "] " << tag << l.msg << "\n";
+    }
+  }
+  void sync_sinks() {
+    if (debug.log_to_stdout)
+      cout.flush();
+    if (flog.is_open())
+      flog.flush();
+  }
+  // moves everything published so far out of the rings, must hold debug.m
+  void drain_locked() {
+    vector <log_ring_ptr> rs;
+    {
+      boost::mutex::scoped_lock lock(m);
+      rs = rings;
+    }
+    vector <log_line> batch;
+    bool orphans = false;
+    for (size_t i = 0; i < rs.size(); i++) {
+      log_ring &r = *rs[i];
+      bool orphan = r.orphan;
+      size_t t = r.tail.load(boost::memory_order_relaxed), h = r.head.load(boost::memory_order_acquire);
+      for (; t != h; t++) {
+        batch.push_back(log_line());
+        swap(batch.back(), r.slots[t % r.slots.size()]);
+      }
+      r.tail.store(t, boost::memory_order_release);
+      orphans |= orphan;
+    }
+    if (orphans) {
+      boost::mutex::scoped_lock lock(m);
+      for (size_t i = 0; i < rings.size(); )
+        if (rings[i]->orphan && (rings[i]->head == rings[i]->tail))
+          rings.erase(rings.begin() + i);
+        else
+          i++;
+    }
+    if (!batch.size())
+      return;
+    sort(batch.begin(), batch.end());
+    for (size_t i = 0; i < batch.size(); i++)
+      write(batch[i]);
+    sync_sinks();
+  }
+public:
+  log_writer() : local(release_ring), seq(0), stopped(false), stopping(false), last_t(0) {
+    flusher = boost::thread(boost::bind(&log_writer::run, this));
+    atexit(stop_writer);
+  }
+  void drain() {
+    boost::mutex::scoped_lock lock(debug.m);
+    drain_locked();
+  }
+  void push(const string &msg, int level) {
+    if (!debug.log_async || stopped) {
+      boost::mutex::scoped_lock lock(debug.m);
+      // keep the order with what is still queued
+      drain_locked();
+      log_line l;
+      l.t = time(0);
+      l.level = level;
+      l.msg = msg;
+      write(l);
+      sync_sinks();
+      return;
+    }
+    log_ring *r = ring();
+    size_t h = r->head.load(boost::memory_order_relaxed);
+    // full ring: nothing is dropped, the producer waits for the flusher
+    while ((h - r->tail.load(boost::memory_order_acquire)) >= r->slots.size()) {
+      if (stopped)
+        drain();
+      else
+        wake();
+      boost::this_thread::yield();
+    }
+    log_line &l = r->slots[h % r->slots.size()];
+    l.seq = seq++;
+    l.t = time(0);
+    l.level = level;
+    l.msg = msg;
+    r->head.store(h + 1, boost::memory_order_release);
+    if ((h + 1 - r->tail.load(boost::memory_order_relaxed)) >= (r->slots.size() / 2))
+      wake();
+  }
+  void stop() {
+    {
+      boost::mutex::scoped_lock lock(m);
+      if (stopping)
+        return;
+      stopping = true;
+    }
+    wake();
+    flusher.join();
+    stopped = true;
+    drain();
+  }
+};
+
+log_writer &writer()
+{
+ // never destroyed: static destructors may still log
+ static log_writer *w = new log_writer;
+ return *w;
+}
+
+void stop_writer()
+{
+ writer().stop();
+}
+
+}
+
 OrientPP::app_logger::~app_logger()
 {
- boost::mutex::scoped_lock scoped_lock(debug.m);
- stringstream m;
- m << "[" + time_str() + "] " << buf.str();
- if (debug.log_to_stdout)
-   cout << m.str() << endl;
- if (debug.log_to_file) {
-   ofstream flog;
-   flog.open(debug.log_file.c_str(), ios::app);
-   flog << m.str() << endl;
-   flog.close();
- }
+ writer().push(buf.str(), level);
+}
+
+void OrientPP::log_flush()
+{
+ writer().drain();
 }
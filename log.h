@@ -4,12 +4,30 @@
 #ifndef _ORIENTPP_LOG_H_
 #define _ORIENTPP_LOG_H_
 
+enum log_level {
+  LOG_ERROR,
+  LOG_WARN,
+  LOG_INFO,
+  LOG_DEBUG,
+  LOG_TRACE
+};
+
+#define ORIENTPP_DEFAULT_LOG_RING_SIZE		4096
+// flusher wakes up at least this often (ms)
+#define ORIENTPP_DEFAULT_LOG_FLUSH_INTERVAL	100
+
 struct debug_t {
   boost::mutex m;
   string log_file;
-  bool log_to_file, log_to_console, log_to_stdout;  
+  bool log_to_file, log_to_console, log_to_stdout;
+  // lines above the level are dropped before formatting
+  int level;
+  // lines go through the per-thread rings and the flusher thread,
+  // false - written synchronously by the caller
+  bool log_async;
   debug_t() : log_file("/var/log/orientpp.log"), log_to_file(false),
-    log_to_console(false), log_to_stdout(false) { }
+    log_to_console(false), log_to_stdout(false), level(LOG_INFO), log_async(true) { }
+  bool enabled(int l) { return (l <= level) && (log_to_file || log_to_stdout); }
 };
 
 extern debug_t debug;
@@ -22,12 +40,19 @@ public:
         return *this;
     }
     ~app_logger();
-    app_logger(long _c = -1) : cid(_c) { }
+    app_logger(long _c = -1, int _l = LOG_INFO) : cid(_c), level(_l) { }
 private:
     ostringstream buf;
     long cid;
+    int level;
 };
 
-#define app_log app_logger()
+// writes out everything logged so far, called at exit too
+void log_flush();
+
+// nothing after the macro is evaluated for a disabled level
+#define app_log_at(l)	for (bool _log_on = OrientPP::debug.enabled(l); _log_on; _log_on = false) \
+			  OrientPP::app_logger(-1, l)
+#define app_log		app_log_at(OrientPP::LOG_INFO)
 
 #endif
@@ -0,0 +1,571 @@
+
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+#include "db.h"
+#include <cstdio>
+#include <algorithm>
+
+namespace OrientPP {
+
+orientmock_config::orientmock_config() : host("127.0.0.1"), port(0), latency(0),
+  result_size(ORIENTPP_DEFAULT_MOCK_RESULT_SIZE), record_size(ORIENTPP_DEFAULT_MOCK_RECORD_SIZE),
+  cluster_records(ORIENTPP_DEFAULT_MOCK_CLUSTER_RECORDS)
+{
+ const char *names[] = { "internal", "index", "manindex", "default", "orole", "ouser", "v", "e" };
+ for (uint i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+   orientcluster cl = { names[i], s16(i), "PHYSICAL", 0 };
+   clusters.push_back(cl);
+ }
+}
+
+// one client, requests are read with buffering and kept raw for the replay lookup
+struct orientmock::conn_t {
+  tcp::socket sock;
+  boost::thread t;
+  boost::atomic<bool> done;
+  vector <char> buf;
+  size_t pos, end;
+  string raw;
+  bool broken; // rest of the request can't be parsed, closed after the error
+  conn_t(boost::asio::io_service &ios) : sock(ios), done(false), buf(ORIENTPP_CHUNK_SIZE),
+    pos(0), end(0), broken(false) { }
+  void read(void *dst, size_t len) {
+    char *d = (char *)dst;
+    while (len) {
+      if (pos == end) {
+        end = sock.read_some(boost::asio::buffer(buf));
+        pos = 0;
+      }
+      size_t n = min(len, end - pos);
+      memcpy(d, &buf[pos], n);
+      raw.append(&buf[pos], n);
+      pos += n;
+      d += n;
+      len -= n;
+    }
+  }
+  u8 read_byte() { u8 v; read(&v, 1); return v; }
+  s16 read_short() { u16 v; read(&v, 2); return s16(ntohs(v)); }
+  s32 read_int() { u32 v; read(&v, 4); return s32(ntohl(v)); }
+  s64 read_long() {
+    u32 hi = read_int();
+    u32 lo = read_int();
+    return s64((u64(hi) << 32) | lo);
+  }
+  string read_bytes() {
+    s32 len = read_int();
+    if (len <= 0)
+      return string();
+    string s(len, 0);
+    read(&s[0], len);
+    return s;
+  }
+};
+
+// fields of a nested (bytes) payload
+struct mock_payload {
+  const string &d;
+  size_t pos;
+  mock_payload(const string &d_) : d(d_), pos(0) { }
+  s32 read_int() {
+    if (pos + 4 > d.size())
+      throw Exception("orientmock: Short command payload");
+    u32 v;
+    memcpy(&v, d.data() + pos, 4);
+    pos += 4;
+    return s32(ntohl(v));
+  }
+  string read_string() {
+    s32 len = read_int();
+    if (len <= 0)
+      return string();
+    if (pos + len > d.size())
+      throw Exception("orientmock: Short command payload");
+    pos += len;
+    return d.substr(pos - len, len);
+  }
+};
+
+orientmock::orientmock(const orientmock_config &c) : cfg(c), acceptor_(io_service_),
+  stopping(false), next_session(1), next_pos(c.cluster_records), requests_(0)
+{
+ if (cfg.replay.size())
+   load_replay();
+ tcp::endpoint ep(boost::asio::ip::address::from_string(cfg.host), cfg.port);
+ acceptor_.open(ep.protocol());
+ acceptor_.set_option(tcp::acceptor::reuse_address(true));
+ acceptor_.bind(ep);
+ acceptor_.listen();
+ acceptor_thread = boost::thread(boost::bind(&orientmock::accept, this));
+}
+
+orientmock::~orientmock()
+{
+ stop();
+}
+
+void orientmock::stop()
+{
+ {
+   boost::mutex::scoped_lock lock(m_lock);
+   if (stopping)
+     return;
+   stopping = true;
+ }
+ // wake up the blocking accept()
+ try {
+   boost::asio::io_service ios;
+   tcp::socket s(ios);
+   s.connect(tcp::endpoint(boost::asio::ip::address::from_string(cfg.host), port()));
+ }
+ catch (std::exception &e) { }
+ acceptor_thread.join();
+ boost::system::error_code ignored_ec;
+ acceptor_.close(ignored_ec);
+ list <conn_ptr> cs;
+ {
+   boost::mutex::scoped_lock lock(m_lock);
+   cs.swap(conns);
+ }
+ for (list <conn_ptr>::iterator it = cs.begin(); it != cs.end(); it++) {
+   (*it)->sock.shutdown(tcp::socket::shutdown_both, ignored_ec);
+   (*it)->t.join();
+ }
+}
+
+// capture pairs of a request write followed by exactly one response
+void orientmock::load_replay()
+{
+ orientcapture_reader f(cfg.replay);
+ orientcapture_frame fr;
+ map <u32, pair<string, int> > last; // connection -> last request, responses seen after it
+ map <u32, string> parts; // connection -> pieces of the response being read
+ for (;;) {
+   try {
+     if (!f.next(fr))
+       break;
+   }
+   catch (Exception &) { // capture of a killed process, the complete records are used
+     break;
+   }
+   if (fr.dir == ORIENTPP_CAPTURE_READ_PART) {
+     parts[fr.conn] += fr.data;
+     continue;
+   }
+   if ((fr.dir == ORIENTPP_CAPTURE_READ) && parts[fr.conn].size()) {
+     fr.data.insert(0, parts[fr.conn]);
+     parts[fr.conn].clear();
+   }
+   if (fr.data.size() < 5)
+     continue;
+   // session ids differ from run to run
+   memset(&fr.data[1], 0, 4);
+   pair<string, int> &l = last[fr.conn];
+   if (fr.dir == ORIENTPP_CAPTURE_WRITE) {
+     l.first = fr.data;
+     l.second = 0;
+   } else if (l.first.size() && !l.second++)
+       replies[l.first] = fr.data;
+     else
+       replies.erase(l.first); // pipelined batch, can't split it
+ }
+}
+
+void orientmock::accept()
+{
+ for (;;) {
+   conn_ptr c(new conn_t(io_service_));
+   boost::system::error_code ec;
+   acceptor_.accept(c->sock, ec);
+   boost::mutex::scoped_lock lock(m_lock);
+   if (stopping)
+     break;
+   if (ec)
+     continue;
+   for (list <conn_ptr>::iterator it = conns.begin(); it != conns.end(); )
+     if ((*it)->done) {
+       (*it)->t.join();
+       it = conns.erase(it);
+     } else
+         it++;
+   conns.push_back(c);
+   c->t = boost::thread(boost::bind(&orientmock::serve, this, c));
+ }
+}
+
+void orientmock::serve(conn_ptr c)
+{
+ try {
+   u16 proto = htons(ORIENTPP_DRIVER_PROTO_VERSION);
+   boost::asio::write(c->sock, boost::asio::buffer(&proto, sizeof(proto)));
+   orientsrv_buf out;
+   for (;;) {
+     c->raw.clear();
+     u8 cmd = c->read_byte();
+     s32 sid = c->read_int();
+     out.data.clear();
+     try {
+       out.append((u8)0);
+       out.append(sid);
+       command(*c, cmd, out);
+     }
+     catch (Exception &e) {
+       // (1)(exception-class:string)(exception-message:string)(0)
+       out.data.clear();
+       out.append((u8)1);
+       out.append(sid);
+       out.append((u8)1);
+       out.append("com.orientechnologies.common.exception.OException");
+       out.append(e.what());
+       out.append((u8)0);
+     }
+     requests_++;
+     if (!out.size()) // DB_CLOSE
+       continue;
+     if (replies.size()) {
+       memset(&c->raw[1], 0, 4);
+       boost::unordered_map<string, string>::iterator it = replies.find(c->raw);
+       if (it != replies.end()) {
+         out.data = it->second;
+         s32 nsid = htonl(sid);
+         memcpy(&out.data[1], &nsid, 4);
+       }
+     }
+     if (cfg.latency)
+       boost::this_thread::sleep(boost::posix_time::microseconds(cfg.latency));
+     boost::asio::write(c->sock, boost::asio::buffer(out.data));
+     if (c->broken)
+       break;
+   }
+ }
+ catch (std::exception &e) { } // client is gone
+ c->done = true;
+}
+
+void orientmock::command(conn_t &c, u8 cmd, orientsrv_buf &out)
+{
+ switch (cmd) {
+   case ORIENTDB_CONNECT:
+   case ORIENTDB_DB_OPEN:
+    {
+     // (driver-name:string)(driver-version:string)(protocol-version:short)(client-id:string)
+     // [(database-name:string)(database-type:string)](user-name:string)(user-password:string)
+     c.read_bytes();
+     c.read_bytes();
+     c.read_short();
+     c.read_bytes();
+     if (cmd == ORIENTDB_DB_OPEN) {
+       c.read_bytes();
+       c.read_bytes();
+     }
+     c.read_bytes();
+     c.read_bytes();
+     out.append(s32(next_session++));
+     if (cmd == ORIENTDB_CONNECT)
+       break;
+    }
+     // fall through, (num-of-clusters:short)[...](cluster-config:bytes)
+   case ORIENTDB_DB_RELOAD:
+     out.append((u16)cfg.clusters.size());
+     for (size_t i = 0; i < cfg.clusters.size(); i++) {
+       out.append(cfg.clusters[i].name);
+       out.append((u16)cfg.clusters[i].id);
+       out.append(cfg.clusters[i].type);
+       out.append((u16)cfg.clusters[i].data_segment);
+     }
+     if (cmd == ORIENTDB_DB_OPEN)
+       out.append((s32)-1);
+     break;
+   case ORIENTDB_DB_CLOSE:
+     out.data.clear();
+     break;
+   case ORIENTDB_DB_EXIST:
+     c.read_bytes();
+     out.append((u8)1);
+     break;
+   case ORIENTDB_DB_CREATE:
+     c.read_bytes();
+     c.read_bytes();
+     c.read_bytes();
+     break;
+   case ORIENTDB_DB_DELETE:
+     c.read_bytes();
+     break;
+   case ORIENTDB_DB_SIZE:
+     out.append(s64(cfg.clusters.size() * cfg.cluster_records * cfg.record_size));
+     break;
+   case ORIENTDB_DB_COUNTRECORDS:
+     out.append(s64(cfg.clusters.size() * cfg.cluster_records));
+     break;
+   case ORIENTDB_DATACLUSTER_COUNT:
+    {
+     s16 n = c.read_short();
+     for (s16 i = 0; i < n; i++)
+       c.read_short();
+     out.append(s64(n * cfg.cluster_records));
+    }
+     break;
+   case ORIENTDB_DATACLUSTER_DATARANGE:
+     c.read_short();
+     out.append(s64(cfg.cluster_records ? 0 : -1));
+     out.append(s64(cfg.cluster_records) - 1);
+     break;
+   case ORIENTDB_COUNT:
+     c.read_bytes();
+     out.append(s64(cfg.cluster_records));
+     break;
+   case ORIENTDB_RECORD_LOAD:
+    {
+     // (cluster-id:short)(cluster-position:long)(fetch-plan:string)(ignore-cache:byte)
+     s16 id = c.read_short();
+     s64 pos = c.read_long();
+     string fetchplan = c.read_bytes();
+     c.read_byte();
+     if ((pos >= 0) && (pos < s64(cfg.cluster_records))) {
+       out.append((u8)1);
+       out.append(content(id, pos));
+       out.append((s32)1);
+       out.append((u8)ORIENT_DOCUMENT_RECORD);
+       // the "out" link
+       if (fetchplan.size() && ((pos + 1) < s64(cfg.cluster_records))) {
+         out.append((u8)2);
+         record(out, id, pos + 1);
+       }
+     }
+     out.append((u8)0);
+    }
+     break;
+   case ORIENTDB_RECORD_CREATE:
+     // (data-segment-id:int)(cluster-id:short)(record-content:bytes)(record-type:byte)(mode:byte)
+     c.read_int();
+     c.read_short();
+     c.read_bytes();
+     c.read_byte();
+     c.read_byte();
+     out.append(s64(next_pos++));
+     out.append((s32)0);
+     break;
+   case ORIENTDB_RECORD_UPDATE:
+    {
+     // (cluster-id:short)(cluster-position:long)(record-content:bytes)(record-version:int)
+     // (record-type:byte)(mode:byte)
+     c.read_short();
+     c.read_long();
+     c.read_bytes();
+     s32 version = c.read_int();
+     c.read_byte();
+     c.read_byte();
+     out.append(s32(version + 1));
+    }
+     break;
+   case ORIENTDB_RECORD_DELETE:
+     // (cluster-id:short)(cluster-position:long)(record-version:int)(mode:byte)
+     c.read_short();
+     c.read_long();
+     c.read_int();
+     c.read_byte();
+     out.append((u8)1);
+     break;
+   case ORIENTDB_TX_COMMIT:
+    {
+     // (tx-id:int)(using-tx-log:byte)[(1)(operation-type:byte)(cluster-id:short)
+     // (cluster-position:long)(record-type:byte)(entry-content)]*(0)
+     c.read_int();
+     c.read_byte();
+     vector < pair<s16, s64> > created;
+     vector <pair<pair<s16, s64>, s32> > updated;
+     while (c.read_byte()) {
+       u8 op = c.read_byte();
+       s16 id = c.read_short();
+       s64 pos = c.read_long();
+       c.read_byte();
+       if (op == ORIENT_TX_CREATE) {
+         c.read_bytes();
+         created.push_back(make_pair(id, pos));
+       } else if (op == ORIENT_TX_UPDATE) {
+           s32 version = c.read_int();
+           c.read_bytes();
+           updated.push_back(make_pair(make_pair(id, pos), version + 1));
+       } else
+           c.read_int();
+     }
+     out.append((s32)created.size());
+     for (size_t i = 0; i < created.size(); i++) {
+       out.append((u16)created[i].first);
+       out.append(created[i].second);
+       out.append((u16)created[i].first);
+       out.append(s64(next_pos++));
+     }
+     out.append((s32)updated.size());
+     for (size_t i = 0; i < updated.size(); i++) {
+       out.append((u16)updated[i].first.first);
+       out.append(updated[i].first.second);
+       out.append(updated[i].second);
+     }
+    }
+     break;
+   case ORIENTDB_COMMAND:
+     query(c, out);
+     break;
+   default:
+     c.broken = true;
+     throw Exception("Unsupported command " + itoa(cmd));
+ }
+}
+
+// word after the keyword, lowercased
+static string word_after(const string &text, const char *keyword)
+{
+ size_t p = text.find(keyword);
+ if (p == string::npos)
+   return string();
+ p += strlen(keyword);
+ while ((p < text.size()) && (text[p] == ' '))
+   p++;
+ size_t e = p;
+ while ((e < text.size()) && !strchr(" ,()", text[e]))
+   e++;
+ return text.substr(p, e - p);
+}
+
+void orientmock::query(conn_t &c, orientsrv_buf &out)
+{
+ // (mode:byte)(command-serialized:bytes)
+ u8 mode = c.read_byte();
+ string payload = c.read_bytes();
+ // (class-name:string)[(language:string)](text:string)(non-text-limit:int)[(fetchplan:string)]
+ // (serialized-params:bytes)
+ mock_payload p(payload);
+ string class_name = p.read_string();
+ if (class_name == "s")
+   p.read_string();
+ string text = p.read_string();
+ s32 limit = p.read_int();
+ string fetchplan;
+ if (class_name == "q")
+   fetchplan = p.read_string();
+ transform(text.begin(), text.end(), text.begin(), ::tolower);
+ // traverse comes as a command, the result is a collection like the select one
+ bool traverse = (class_name == "c") && !text.compare(0, 8, "traverse");
+ if ((class_name == "q") || traverse) {
+   if (!text.compare(0, 12, "select count")) {
+     out.append((u8)'l');
+     out.append((s32)1);
+     out.append((u16)0);
+     out.append((u8)ORIENT_DOCUMENT_RECORD);
+     out.append((u16)-1);
+     out.append((s64)-1);
+     out.append((s32)0);
+     stringstream ss;
+     ss << "count:" << cfg.cluster_records << "l";
+     out.append(ss.str());
+     return;
+   }
+   string target = word_after(text, " from ");
+   if (!target.size())
+     throw Exception("Error on parsing command: Target is missing in '" + text + "'");
+   s16 id = cluster_of(target);
+   size_t n = cfg.result_size;
+   string l = word_after(text, " limit ");
+   if (l.size())
+     limit = atoi(l.c_str());
+   if ((limit >= 0) && (size_t(limit) < n))
+     n = limit;
+   if (n > cfg.cluster_records)
+     n = cfg.cluster_records;
+   if (target == "broken") {
+     // the second record has an unknown header, the rest of the cluster follows it, most of
+     // the stream is still on the way when the client fails
+     out.append((u8)'l');
+     out.append((s32)cfg.cluster_records);
+     for (u64 i = 0; i < cfg.cluster_records; i++)
+       if (i == 1)
+         out.append((u16)-1);
+       else
+         record(out, id, i);
+     return;
+   }
+   if (target == "unknown") {
+     // result type the client does not know, the records follow it anyway
+     out.append((u8)'x');
+     for (u64 i = 0; i < cfg.cluster_records; i++)
+       record(out, id, i);
+     return;
+   }
+   if (mode == 'a') {
+     // [(1)(record)]*[(2)(record)]*(0)
+     for (size_t i = 0; i < n; i++) {
+       out.append((u8)1);
+       record(out, id, i);
+     }
+     if (fetchplan.size() && (n < cfg.cluster_records)) {
+       out.append((u8)2);
+       record(out, id, n);
+     }
+     out.append((u8)0);
+     return;
+   }
+   out.append((u8)'l');
+   out.append((s32)n);
+   for (size_t i = 0; i < n; i++)
+     record(out, id, i);
+   return;
+ }
+ if (class_name == "c") {
+   if (!text.compare(0, 6, "insert") || !text.compare(0, 6, "create")) {
+     string cls = word_after(text, " into ");
+     if (!cls.size())
+       cls = word_after(text, (text.find(" edge") != string::npos) ? " edge " : " vertex ");
+     out.append((u8)'r');
+     record(out, cluster_of(cls), next_pos++);
+     return;
+   }
+   if (!text.compare(0, 6, "update") || !text.compare(0, 6, "delete")) {
+     out.append((u8)'a');
+     out.append("1");
+     return;
+   }
+ }
+ out.append((u8)'n');
+}
+
+s16 orientmock::cluster_of(const string &class_name)
+{
+ if ((class_name.size() > 1) && (class_name[0] == '#')) // #cluster:pos
+   return atoi(class_name.c_str() + 1);
+ for (size_t i = 0; i < cfg.clusters.size(); i++)
+   if (!strcasecmp(cfg.clusters[i].name.c_str(), class_name.c_str()))
+     return cfg.clusters[i].id;
+ return cfg.clusters.size() ? cfg.clusters.back().id : 0;
+}
+
+string orientmock::content(s16 cluster_id, s64 pos)
+{
+ string cls = "Doc";
+ for (size_t i = 0; i < cfg.clusters.size(); i++)
+   if (cfg.clusters[i].id == cluster_id) {
+     cls = cfg.clusters[i].name;
+     cls[0] = toupper(cls[0]);
+   }
+ stringstream ss;
+ ss << cls << "@name:\"node " << pos << "\",n:" << pos << ",score:" << pos << ".5d,out:#"
+   << cluster_id << ":" << (pos + 1) << ",tags:[\"a\",\"b\"],info:{\"k\":\"v\"}";
+ string r = ss.str();
+ if (r.size() + 8 < cfg.record_size)
+   r += ",pad:\"" + string(cfg.record_size - r.size() - 8, 'x') + "\"";
+ return r;
+}
+
+void orientmock::record(orientsrv_buf &out, s16 cluster_id, s64 pos)
+{
+ // (0:short)(record-type:byte)(cluster-id:short)(cluster-position:long)(record-version:int)
+ // (record-content:bytes)
+ out.append((u16)0);
+ out.append((u8)ORIENT_DOCUMENT_RECORD);
+ out.append((u16)cluster_id);
+ out.append(pos);
+ out.append((s32)1);
+ out.append(content(cluster_id, pos));
+}
+
+}
@@ -0,0 +1,72 @@
+
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+#ifndef _ORIENTPP_MOCK_H_
+#define _ORIENTPP_MOCK_H_
+
+#include <list>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace OrientPP {
+
+enum {
+  ORIENTPP_DEFAULT_MOCK_RESULT_SIZE = 10,
+  ORIENTPP_DEFAULT_MOCK_RECORD_SIZE = 128,
+  ORIENTPP_DEFAULT_MOCK_CLUSTER_RECORDS = 1000
+};
+
+struct orientmock_config {
+  string host;                  // listen address
+  u16 port;                     // 0 - any free one, see orientmock::url()
+  int latency;                  // usec before every response
+  size_t result_size;           // records returned by a select, limit applies
+  size_t record_size;           // approximate content size of the synthetic records
+  u64 cluster_records;          // positions 0 .. n - 1 exist in every cluster
+  vector <orientcluster> clusters; // sent on DB_OPEN / DB_RELOAD
+  // capture file (see orientcapture), its responses are served for byte-identical requests
+  string replay;
+  orientmock_config();
+};
+
+// stand-in OrientDB server speaking protocol 12 on a local socket, serves synthetic records:
+// cluster:pos is "Class@name:"node pos",n:pos,score:pos.5d,out:#cluster:pos+1,...",
+// "select from Broken" gets a collection that can't be parsed past its first record
+class orientmock {
+  struct conn_t;
+  typedef boost::shared_ptr<conn_t> conn_ptr;
+  orientmock_config cfg;
+  boost::asio::io_service io_service_;
+  tcp::acceptor acceptor_;
+  boost::thread acceptor_thread;
+  boost::mutex m_lock;
+  list <conn_ptr> conns;
+  bool stopping;
+  boost::atomic<s32> next_session;
+  boost::atomic<s64> next_pos;
+  boost::atomic<u64> requests_;
+  boost::unordered_map<string, string> replies; // request with zeroed session id -> response
+  void load_replay();
+  void accept();
+  void serve(conn_ptr c);
+  void command(conn_t &c, u8 cmd, orientsrv_buf &out);
+  void query(conn_t &c, orientsrv_buf &out);
+  string content(s16 cluster_id, s64 pos);
+  void record(orientsrv_buf &out, s16 cluster_id, s64 pos);
+  s16 cluster_of(const string &class_name);
+  orientmock& operator= (const orientmock&) = delete;
+  orientmock(const orientmock &)  = delete;
+ public:
+  orientmock(const orientmock_config &c = orientmock_config());
+  ~orientmock();
+  void stop();
+  u16 port() { return acceptor_.local_endpoint().port(); }
+  // host:port for orientsrv / orientpool_config
+  string url() { return cfg.host + ":" + itoa(port()); }
+  u64 requests() { return requests_; }
+};
+
+}
+
+#endif
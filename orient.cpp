@@ -6,6 +6,13 @@
 namespace OrientPP {
 
 unique_counter client_id;
+
+orientio &orientio::shared()
+{
+ // the handlers only hand completions over, one thread keeps up with many connections
+ static orientio io(1);
+ return io;
+}
 // connect lock, needed if multiple client/threaded reconnect occures
 boost::mutex c_lock;
 
@@ -60,6 +67,99 @@ void orientsrv::connect(string _url, string _user, string _pass)
  }
 }
 
+// (num-of-clusters:short)[(cluster-name:string)(cluster-id:short)(cluster-type:string)
+// (cluster-dataSegmentId:short)], false if the list was cut short
+bool orientdb::parse_clusters(orientrsp &rsp)
+{
+ u16 num_of_clusters;
+ rsp.parse(&num_of_clusters);
+ u16 real_num_of_clusters = 0;
+ clusters_.clear();
+ cluster_ids_.clear();
+ while (real_num_of_clusters < num_of_clusters) {
+   string cl_name, cl_type;
+   u16 cl_id, cl_data_segment_id;
+   rsp.parse(&cl_name);
+   if (!cl_name.size())
+     break;
+   real_num_of_clusters++;
+   rsp.parse(&cl_id);
+   if (cl_id > num_of_clusters)
+     error("Too big cluster number !");
+   rsp.parse(&cl_type);
+   rsp.parse(&cl_data_segment_id);
+   if (verbose() > 1)
+     app_log << "id: " << cl_id << ", name: " << cl_name << ", type: " << cl_type
+       << ", data_segment_id :" << cl_data_segment_id;
+   //       - ,     
+   // ...
+   orientcluster cl;
+   cl.name = cl_name;
+   cl.id = cl_id;
+   cl.type = cl_type;
+   cl.data_segment = cl_data_segment_id;
+   clusters_.push_back(cl);
+   cluster_ids_[cl_name] = cl_id;
+ }
+ if (verbose() > 1) {
+   if (real_num_of_clusters != num_of_clusters)
+     app_log << "DB has " << real_num_of_clusters << " clusters [reported " << num_of_clusters << "]";
+   else {
+     app_log << "DB has " << real_num_of_clusters << " clusters";
+   }
+  }
+ return real_num_of_clusters == num_of_clusters;
+}
+
+void orientdb::reload()
+{
+ orientrsp rsp = send(ORIENTDB_DB_RELOAD);
+ parse_clusters(rsp);
+}
+
+s16 orientdb::cluster_id(const string &name)
+{
+ string n = name;
+ for (size_t i = 0; i < n.size(); i++)
+   n[i] = tolower(n[i]);
+ map <string, s16>::iterator it = cluster_ids_.find(n);
+ return (it == cluster_ids_.end()) ? -1 : it->second;
+}
+
+const orientcluster *orientdb::cluster(s16 id)
+{
+ for (size_t i = 0; i < clusters_.size(); i++)
+   if (clusters_[i].id == id)
+     return &clusters_[i];
+ return 0;
+}
+
+vector <s16> orientdb::class_clusters(const string &class_name)
+{
+ map <string, vector <s16> >::iterator it = class_clusters_.find(class_name);
+ if (it != class_clusters_.end())
+   return it->second;
+ // the default cluster of a class is named after it, the catalog has no schema
+ vector <s16> ids;
+ s16 id = cluster_id(class_name);
+ if (id >= 0)
+   ids.push_back(id);
+ return ids;
+}
+
+void orientdb::class_clusters(const string &class_name, const vector <s16> &ids)
+{
+ class_clusters_[class_name] = ids;
+}
+
+orient_record_t orientdb::create(const string &class_name, const string &content, u8 type)
+{
+ vector <s16> ids = class_clusters(class_name);
+ if (!ids.size())
+   error("orientdb::create(): No cluster for class " + class_name);
+ return create(ids[0], content, type);
+}
+
 u64 orientdb::size()
 {
  orientrsp rsp = send(ORIENTDB_DB_SIZE);
@@ -80,13 +180,294 @@ u64 orientdb::count()
  return recs;
 }
 
+void orientdb::cluster_range(s16 cluster_id, s64 &begin, s64 &end)
+{
+ // (cluster-number:short)
+ orientsrv_buf r;
+ r.append((u16)cluster_id);
+ orientrsp rsp = send(ORIENTDB_DATACLUSTER_DATARANGE, r);
+ // (begin:long)(end:long)
+ rsp.parse(&begin);
+ rsp.parse(&end);
+ if (verbose() > 1)
+   app_log << "Cluster " << cluster_id << " range " << begin << " - " << end;
+}
+
+u64 orientdb::cluster_count(const vector <s16> &cluster_ids)
+{
+ // (cluster-count:short)(cluster-number:short)*
+ orientsrv_buf r;
+ r.append((u16)cluster_ids.size());
+ for (size_t i = 0; i < cluster_ids.size(); i++)
+   r.append((u16)cluster_ids[i]);
+ orientrsp rsp = send(ORIENTDB_DATACLUSTER_COUNT, r);
+ // (records-in-clusters:long)
+ u64 recs;
+ rsp.parse(&recs);
+ if (verbose() > 1)
+   app_log << cluster_ids.size() << " clusters have " << recs << " records";
+ return recs;
+}
+
+void orientdb::begin()
+{
+ if (tx_active)
+   error("orientdb::begin(): Transaction is already active");
+ tx_ops.clear();
+ tx_next_pos = -2;
+ tx_active = true;
+}
+
+void orientdb::rollback()
+{
+ // nothing was sent yet
+ tx_ops.clear();
+ tx_active = false;
+}
+
+rid_t orientdb::tx_create(s16 cluster_id, const string &content, u8 type)
+{
+ if (!tx_active)
+   error("orientdb::tx_create(): No active transaction");
+ orienttx_entry e;
+ e.op = ORIENT_TX_CREATE;
+ e.rid = rid_t(cluster_id, tx_next_pos--);
+ e.type = type;
+ e.version = 0;
+ e.content = content;
+ tx_ops.push_back(e);
+ return e.rid;
+}
+
+void orientdb::tx_update(const rid_t &rid, s32 version, const string &content, u8 type)
+{
+ if (!tx_active)
+   error("orientdb::tx_update(): No active transaction");
+ orienttx_entry e;
+ e.op = ORIENT_TX_UPDATE;
+ e.rid = rid;
+ e.type = type;
+ e.version = version;
+ e.content = content;
+ tx_ops.push_back(e);
+}
+
+void orientdb::tx_remove(const rid_t &rid, s32 version)
+{
+ if (!tx_active)
+   error("orientdb::tx_remove(): No active transaction");
+ orienttx_entry e;
+ e.op = ORIENT_TX_DELETE;
+ e.rid = rid;
+ e.type = ORIENT_DOCUMENT_RECORD;
+ e.version = version;
+ tx_ops.push_back(e);
+}
+
+orienttx_result orientdb::commit()
+{
+ if (!tx_active)
+   error("orientdb::commit(): No active transaction");
+ orienttx_result res;
+ vector <orienttx_entry> ops;
+ ops.swap(tx_ops);
+ tx_active = false;
+ if (!ops.size())
+   return res;
+ if (cache_)
+   for (size_t i = 0; i < ops.size(); i++)
+     if (ops[i].op != ORIENT_TX_CREATE)
+       cache_->invalidate(ops[i].rid);
+ // (tx-id:int)(using-tx-log:byte)(tx-entry)*(0-byte indicating end-of-records)
+ orientsrv_buf r;
+ r.append((s32)++tx_seq);
+ r.append((u8)1);
+ for (size_t i = 0; i < ops.size(); i++) {
+   orienttx_entry &e = ops[i];
+   // (1:byte)(operation-type:byte)(cluster-id:short)(cluster-position:long)(record-type:byte)
+   r.append((u8)1);
+   r.append(e.op);
+   r.append((u16)e.rid.id);
+   r.append((s64)e.rid.pos);
+   r.append(e.type);
+   switch (e.op) {
+     case ORIENT_TX_CREATE: // (record-content:bytes)
+       r.append(e.content);
+       break;
+     case ORIENT_TX_UPDATE: // (version:int)(record-content:bytes)
+       r.append(e.version);
+       r.append(e.content);
+       break;
+     case ORIENT_TX_DELETE: // (version:int)
+       r.append(e.version);
+       break;
+   }
+ }
+ r.append((u8)0);
+ if (verbose() > 1)
+   app_log << "orientdb::commit(): " << ops.size() << " operations, " << r.size() << " bytes";
+ // never resent: the server may have applied it even when the connection broke
+ try {
+   orientrsp rsp = send(ORIENTDB_TX_COMMIT, r);
+   // (created-record-count:int)[(client-specified-cluster-id:short)
+   // (client-specified-cluster-position:long)(created-cluster-id:short)
+   // (created-cluster-position:long)]*(updated-record-count:int)[(updated-cluster-id:short)
+   // (updated-cluster-position:long)(new-record-version:int)]*
+   s32 n;
+   rsp.parse(&n);
+   for (s32 i = 0; i < n; i++) {
+     s16 tmp_id, id;
+     s64 tmp_pos, pos;
+     rsp.parse(&tmp_id);
+     rsp.parse(&tmp_pos);
+     rsp.parse(&id);
+     rsp.parse(&pos);
+     res.created[rid_t(tmp_id, tmp_pos)] = rid_t(id, pos);
+   }
+   rsp.parse(&n);
+   for (s32 i = 0; i < n; i++) {
+     s16 id;
+     s64 pos;
+     s32 version;
+     rsp.parse(&id);
+     rsp.parse(&pos);
+     rsp.parse(&version);
+     res.versions[rid_t(id, pos)] = version;
+   }
+ }
+ catch (boost::system::system_error &e) {
+   error(string("orientdb::commit(): ") + e.what());
+ }
+ if (verbose() > 1)
+   app_log << "orientdb::commit(): " << res.created.size() << " created, " << res.versions.size()
+     << " updated";
+ return res;
+}
+
+orient_record_t orientdb::load(const rid_t &rid, const string &fetchplan)
+{
+ orient_record_t cached;
+ if (cache_ && !fetchplan.size() && cache_->get(rid, cached))
+   return cached;
+ // same request and reply as the pipelined one, including the reconnect
+ orientpipeline p(this);
+ orientresult_ptr res = p.load(rid, fetchplan);
+ p.flush();
+ if (!res->records.size())
+   return orient_null;
+ return res->records[0];
+}
+
+orient_record_t orientdb::create(s16 cluster_id, const string &content, u8 type)
+{
+ if (tx_active) {
+   rid_t rid = tx_create(cluster_id, content, type);
+   return orient_record_t(type, rid.id, rid.pos, 0, orientbytes(content));
+ }
+ // (datasegment-id:int)(cluster-id:short)(record-content:bytes)(record-type:byte)(mode:byte)
+ orientsrv_buf r;
+ r.append((s32)-1); // default data segment
+ r.append((u16)cluster_id);
+ r.append(content);
+ r.append(type);
+ r.append((u8)0); // synchronous
+ s64 pos;
+ s32 version;
+ try {
+   orientrsp rsp = send(ORIENTDB_RECORD_CREATE, r);
+   // (cluster-position:long)(record-version:int)
+   rsp.parse(&pos);
+   rsp.parse(&version);
+ }
+ catch (boost::system::system_error &e) {
+   // not retried, the record might have been created already
+   error(string("orientdb::create(): ") + e.what());
+ }
+ if (verbose() > 1)
+   app_log << "orientdb::create(): #" << cluster_id << ":" << pos << " v" << version;
+ orient_record_t rec(type, cluster_id, pos, version, orientbytes(content));
+ if (cache_)
+   cache_->put(rec);
+ return rec;
+}
+
+orient_record_t orientdb::update(const rid_t &rid, s32 version, const string &content, u8 type)
+{
+ if (tx_active) {
+   tx_update(rid, version, content, type);
+   return orient_record_t(type, rid.id, rid.pos, version, orientbytes(content));
+ }
+ // (cluster-id:short)(cluster-position:long)(record-content:bytes)(record-version:int)
+ // (record-type:byte)(mode:byte)
+ orientsrv_buf r;
+ r.append((u16)rid.id);
+ r.append((s64)rid.pos);
+ r.append(content);
+ r.append(version);
+ r.append(type);
+ r.append((u8)0); // synchronous
+ s32 new_version;
+ try {
+   orientrsp rsp = send(ORIENTDB_RECORD_UPDATE, r);
+   // (record-version:int)
+   rsp.parse(&new_version);
+ }
+ catch (boost::system::system_error &e) {
+   if (cache_)
+     cache_->invalidate(rid);
+   error(string("orientdb::update(): ") + e.what());
+ }
+ if (verbose() > 1)
+   app_log << "orientdb::update(): " << string(rid) << " v" << new_version;
+ orient_record_t rec(type, rid.id, rid.pos, new_version, orientbytes(content));
+ if (cache_)
+   cache_->put(rec);
+ return rec;
+}
+
+bool orientdb::remove(const rid_t &rid, s32 version)
+{
+ if (tx_active) {
+   tx_remove(rid, version);
+   return true;
+ }
+ // (cluster-id:short)(cluster-position:long)(record-version:int)(mode:byte)
+ orientsrv_buf r;
+ r.append((u16)rid.id);
+ r.append((s64)rid.pos);
+ r.append(version);
+ r.append((u8)0); // synchronous
+ u8 deleted = 0;
+ if (cache_)
+   cache_->invalidate(rid);
+ try {
+   orientrsp rsp = send(ORIENTDB_RECORD_DELETE, r);
+   // (payload-status:byte)
+   rsp.parse(&deleted);
+ }
+ catch (boost::system::system_error &e) {
+   if (cache_)
+     cache_->invalidate(rid);
+   error(string("orientdb::remove(): ") + e.what());
+ }
+ // a load done while the request was on the way may have cached the record again
+ if (cache_)
+   cache_->invalidate(rid);
+ if (verbose() > 1)
+   app_log << "orientdb::remove(): " << string(rid) << (deleted ? " deleted" : " not found");
+ return deleted;
+}
+
 void orientdb::close()
 {
+ boost::unique_lock<boost::recursive_mutex> state(s_lock);
  if (!isconnected())
    return;
  if (verbose() > 1)
    app_log << "Closing " << db << " for user " << user;
- orientrsp rsp = send(ORIENTDB_DB_CLOSE);
+ // a dropped connection took the session with it
+ if (srv->tc.is_open())
+   send(ORIENTDB_DB_CLOSE);
  // no result returned (?!)
  session.connected = false;
  session.id = -1;
@@ -96,6 +477,7 @@ void orientdb::close()
 
 void orientdb::open(string db_, int db_type_, string u, string p)
 {
+ boost::unique_lock<boost::recursive_mutex> state(s_lock);
  if (!srv->isconnected())
    reconnect();
  if (isconnected())
@@ -135,41 +517,14 @@ restart:
  //  - 1.2.0-snapshot   num_of_clusters >     
  //  - cluster_id   >  num_of_clusters (?!)    OStorageRemote.java:1822
  //  -          
- u16 num_of_clusters;
- rsp.parse(&num_of_clusters);
- u16 real_num_of_clusters = 0;
- while (real_num_of_clusters < num_of_clusters) {
-   string cl_name, cl_type;
-   u16 cl_id, cl_data_segment_id;
-   rsp.parse(&cl_name);
-   if (!cl_name.size())
-     break;
-   real_num_of_clusters++;
-   rsp.parse(&cl_id);
-   if (cl_id > num_of_clusters)
-     error("Too big cluster number !");
-   rsp.parse(&cl_type);
-   rsp.parse(&cl_data_segment_id);
-   if (verbose() > 1)
-     app_log << "id: " << cl_id << ", name: " << cl_name << ", type: " << cl_type
-       << ", data_segment_id :" << cl_data_segment_id;
-   //       - ,     
-   // ...
- }
- if (real_num_of_clusters == num_of_clusters) {
+ bool complete = parse_clusters(rsp);
+ if (complete) {
    // read (cluster-config:bytes)
    orientsrv_buf cluster_config;
    rsp.parse(&cluster_config);
    if (cluster_config.size())
      app_log << "TODO: parse cluster_config";
  }
- if (verbose() > 1) {
-   if (real_num_of_clusters != num_of_clusters)
-     app_log << "DB has " << real_num_of_clusters << " clusters [reported " << num_of_clusters << "]";
-   else {
-     app_log << "DB has " << real_num_of_clusters << " clusters";
-   }
-  }
  if (verbose())
    app_log << "orientdb::open(): Opened DB " << db << ", DB session [0x" << hex << session.id
      << "] for user " << user;
@@ -236,17 +591,19 @@ orientsrv::~orientsrv()
 
 orientdb::~orientdb()
 {
+ if (async_)
+   async_->stop();
  if (verbose() > 1)
    app_log << "~orientdb_t(): Closing database " << db;
 }
 
-orient_record_t orientquery::parse_record(orientrsp &rsp)
+orient_record_t orientquery::parse_record(orientrsp &rsp, orientresult *result)
 {
  u8 record_type;
  s16 record_header, cluster_id;
  s64 cluster_pos;
  s32 record_version;
- orientsrv_buf record_content;
+ orientbytes record_content;
  rsp.parse(&record_header);
  switch (record_header) {
    case -2: // NULL
@@ -264,28 +621,225 @@ orient_record_t orientquery::parse_record(orientrsp &rsp)
      rsp.parse(&cluster_id);
      rsp.parse(&cluster_pos);
      rsp.parse(&record_version);
-     rsp.parse(&record_content);
+     rsp.parse(&record_content, result ? &result->chunks : 0);
      if (db->verbose() > 1)
        app_log << "got record: " << cluster_id << ":" << cluster_pos << ", type: " << record_type
          << ", ver: " << record_version << ", len: " << record_content.size();
-     return orient_record_t(record_type, cluster_id, cluster_pos, record_version, record_content.data);
+     {
+       orient_record_t r(record_type, cluster_id, cluster_pos, record_version, record_content);
+       if (result && result->arena)
+         r.use_arena(result->arena);
+       return r;
+     }
    default:
      throw Exception("parse_record(): unknown record_header [" + itoa(record_header) + "]");
  }
  return orient_null;;
 }
 
-u32 orientquery::parse_records_collection(orientrsp &rsp, vector <orient_record_t> *records)
+u32 orientquery::parse_records_collection(orientrsp &rsp, orientresult *result)
 {
  u32 n_records;
  rsp.parse(&n_records);
  if (!n_records)
    return 0;
+ result->records.reserve(result->records.size() + n_records);
  for (u32 i = 0; i < n_records; i++)
-   records->push_back(parse_record(rsp));
+   result->records.push_back(parse_record(rsp, result));
  return n_records;
 }
 
+void orientquery::encode(orientsrv_buf &r, int query_type, bool async)
+{
+ // (mode:byte)(command-serialized:bytes)
+ // 'a' - async, 's' - sync
+ // linked records are streamed only in async mode, the reply is parsed the same way
+ u8 mode = (async || fetchplan_.size()) ? 'a' : 's';
+ r.append(mode);
+ if (envelope_type != query_type)
+   encode_envelope(query_type);
+ // written in place, no separate buffer for the nested payload
+ size_t command_serialized = r.begin_bytes();
+ r.data.append(envelope.data);
+ encode_params(r);
+ r.end_bytes(command_serialized);
+}
+
+void orientquery::encode_envelope(int query_type)
+{
+ envelope.clear();
+ // command-serialized: (class-name:string)(command-payload)
+ // q - com.orientechnologies.orient.core.sql.query.OSQLSynchQuery: query (select)
+ // c - com.orientechnologies.orient.core.sql.OCommandSQL: SQL commands (insert, update)
+ // s or 'com.orientechnologies.orient.core.command.script.OCommandScript' : Script commands
+ const char *class_name = 0;
+ if (query_type == AS_SQL) {
+   // check for select or insert/update
+   if (!strncasecmp("select", q.c_str(), 6))
+     class_name = "q"; // com.orientechnologies.orient.core.sql.query.OSQLSynchQuery
+   else
+     class_name = "c"; // com.orientechnologies.orient.core.sql.OCommandSQL
+ } else if (query_type == AS_JAVASCRIPT)
+     class_name = "s";
+ else if (query_type == AS_GREMLIN)
+   class_name = "com.orientechnologies.orient.graph.gremlin.OCommandGremlin";
+ else
+   db->error("Unsupported script language !");
+ envelope.append(class_name);
+ // SQL Command
+ // (text:string)(non-text-limit:int)[(fetchplan:string)](serialized-params:bytes)
+ // SQL Script Command
+ // (language:string)(text:string)(non-text-limit:int)[(fetchplan:string)](serialized-params:bytes)
+ if (query_type == AS_JAVASCRIPT) {
+   envelope.append("javascript");
+ }
+ envelope.append(q);
+ s32 non_text_limit = -1;
+ envelope.append(non_text_limit);
+ // queries always carry the fetch plan slot, commands have none
+ if (class_name[0] == 'q' && !class_name[1])
+   envelope.append(fetchplan_);
+ inserts_ = !strncasecmp("create", q.c_str(), 6) || !strncasecmp("insert", q.c_str(), 6);
+ envelope_type = query_type;
+}
+
+void orientquery::encode_params(orientsrv_buf &r)
+{
+ if (!params.size()) { // no params
+   r.append((s32)0);
+   return;
+ }
+ // document in CSV form: params:{"0":value,"1":value}
+ params_buf = "params:{";
+ for (uint i = 0; i < params.size(); i++) {
+   if (i)
+     params_buf += ',';
+   params_buf += '"';
+   params_buf += itoa(i);
+   params_buf += "\":";
+   params_buf += params[i];
+ }
+ params_buf += '}';
+ r.append(params_buf);
+}
+
+void orientquery::bind(uint pos, const string &val)
+{
+ if (!prepared) {
+   // placeholders refer to the text collected so far
+   if (buf.str().size()) {
+     text(buf.str());
+     buf.str("");
+   }
+   params.clear();
+   prepared = true;
+ }
+ if (pos >= params.size())
+   params.resize(pos + 1);
+ params[pos] = val;
+}
+
+void orientquery::set(uint pos, const string &val)
+{
+ bind(pos, "\"" + orientsrv_buf().safe_quote(val) + "\"");
+}
+
+void orientquery::set(uint pos, const char *val)
+{
+ set(pos, string(val));
+}
+
+void orientquery::set(uint pos, int val)
+{
+ bind(pos, itoa(val));
+}
+
+void orientquery::set(uint pos, s64 val)
+{
+ stringstream ss;
+ ss << val << 'l';
+ bind(pos, ss.str());
+}
+
+void orientquery::set(uint pos, double val)
+{
+ stringstream ss;
+ ss.precision(17);
+ ss << val << 'd';
+ bind(pos, ss.str());
+}
+
+void orientquery::set(uint pos, bool val)
+{
+ bind(pos, val ? "true" : "false");
+}
+
+void orientquery::set(uint pos, rid_t val)
+{
+ bind(pos, string(val));
+}
+
+void orientquery::set_null(uint pos)
+{
+ bind(pos, "");
+}
+
+void orientquery::parse_result(orientrsp &rsp, orientresult *result)
+{
+ // [(payload-status:byte)[(content:?)]*]+
+ u8 payload_status;
+ rsp.parse(&payload_status);
+ switch (payload_status) {
+   case 'l': // collection of records
+     parse_records_collection(rsp, result);
+     break;
+   case 'r': // single record returned
+     result->records.push_back(parse_record(rsp, result));
+     break;
+   case 0:   // no records
+   case 'n': // null result
+     break;
+   case 1:   // record is returned as a resultset
+   case 2:   // record is returned as pre-fetched to be loaded in client's cache only
+             // It's not part of the result set but the client knows that it's available for
+             // later access
+     // async mode stream, terminated by 0
+     while (payload_status) {
+       if ((payload_status != 1) && (payload_status != 2))
+         db->error("Unsupported async query result [" + itoa(payload_status) + "]");
+       orient_record_t r = parse_record(rsp, result);
+       if (payload_status == 1)
+         result->records.push_back(r);
+       else {
+         result->prefetched[r.rid] = r;
+         if (db->cache())
+           db->cache()->put(r);
+       }
+       rsp.parse(&payload_status);
+     }
+     if (db->verbose() > 1)
+       app_log << "Got " << result->prefetched.size() << " pre-fetched records";
+     break;
+   case 'a': // serialized result
+    {
+       string res;
+       rsp.parse(&res);
+       if (db->verbose() > 1)
+         app_log << "Got serialized result [" << res << "]";
+       result->records.push_back(orient_record_t(res));
+    }
+     break;
+   default:
+     db->error("Unsupported query result [" + itoa(payload_status) + "]");
+ }
+ if (inserts_ && result->records.size()) {
+   insert_id = result->records[0];
+   insert_id.type = ORIENT_RECORD_ID;
+ }
+ if (db->verbose() > 1)
+   app_log << "Query returns " << result->records.size() << " records";
+}
+
 #ifdef ORIENTPP_DEBUG
 #undef execute
 orientresult_ptr orientquery::execute_debug(const char *file, int line, const char *func,
@@ -295,41 +849,18 @@ orientresult_ptr orientquery::execute(const char *qs, int query_type)
 #endif
 {
  bool reconnecting = false;
- orientresult_ptr result(new orientresult);
+ orientresult_ptr result(new orientresult(zero_copy_, arena_));
 restart:
  try {
   if (!prepared) {
     if (qs)
-      q = qs;
+      text(qs);
     else if (buf.str().size())
-      q = buf.str();
+      text(buf.str());
     buf.str("");
   }
   if (!q.size()) // empty query
     return result;
-  orientsrv_buf r;
-  // (mode:byte)(command-serialized:bytes)
-  // 'a' - async, 's' - sync
-  u8 mode = 's';
-  r.append(mode);  
-  orientsrv_buf command_serialized;
-  // command-serialized: (class-name:string)(command-payload)
-  // q - com.orientechnologies.orient.core.sql.query.OSQLSynchQuery: query (select)
-  // c - com.orientechnologies.orient.core.sql.OCommandSQL: SQL commands (insert, update)
-  // s or 'com.orientechnologies.orient.core.command.script.OCommandScript' : Script commands
-  string class_name;
-  if (query_type == AS_SQL) {
-    // check for select or insert/update
-    if (!strncasecmp("select", q.c_str(), 6))
-      class_name = "q"; // com.orientechnologies.orient.core.sql.query.OSQLSynchQuery
-    else
-      class_name = "c"; // com.orientechnologies.orient.core.sql.OCommandSQL
-  } else if (query_type == AS_JAVASCRIPT)
-      class_name = "s";
-  else if (query_type == AS_GREMLIN)
-    class_name = "com.orientechnologies.orient.graph.gremlin.OCommandGremlin";
-  else
-    db->error("Unsupported script language !");
 #ifdef ORIENTPP_DEBUG
   string qtype_str;
   if (query_type == AS_SQL)
@@ -341,63 +872,10 @@ restart:
   app_log << "OrientPP::query [" << qtype_str << "] [" << func << "():" << file << ":" << line << "] "
     << q;
 #endif 
-  command_serialized.append(class_name);
-  // SQL Command
-  // (text:string)(non-text-limit:int)[(fetchplan:string)](serialized-params:bytes)
-  // SQL Script Command
-  // (language:string)(text:string)(non-text-limit:int)[(fetchplan:string)](serialized-params:bytes)
-  if (query_type == AS_JAVASCRIPT) {
-    string language = "javascript";
-    command_serialized.append(language);
-  }
-  command_serialized.append(q);
-  s32 non_text_limit = -1;
-  command_serialized.append(non_text_limit);
-  // string fetchplan;
-  // command_serialized.append(fetchplan);
-  //if (prepared_statement) {
-  // orientsrv_buf serialized_params;
-  // command_serialized.append(serialized_params);
-  // } else // no params
-  command_serialized.append((s32)0);
-  r.append(command_serialized);
-  orientrsp rsp = db->send(ORIENTDB_COMMAND, r);
-//  db->verbose(2);
-  // [(payload-status:byte)[(content:?)]*]+
-  u8 payload_status;
-  rsp.parse(&payload_status);
-  switch (payload_status) {
-    case 'l': // collection of records
-      parse_records_collection(rsp, &(result->records));
-      break;
-    case 'r': // single record returned
-      result->records.push_back(parse_record(rsp));
-      break;
-    case 0:   // no records
-    case 'n': // null result
-      break;
-    case 1:   // record is returned as a resultset
-    case 2:   // record is returned as pre-fetched to be loaded in client's cache only
-              // It's not part of the result set but the client knows that it's available for
-              // later access
-    case 'a': // serialized result
-     {
-        string res;
-        rsp.parse(&res);
-        if (db->verbose() > 1)
-          app_log << "Got serialized result [" << res << "]";
-        result->records.push_back(orient_record_t(res));
-     }
-      break;
-    default:
-      db->error("Unsupported query result [" + itoa(payload_status) + "]");
-  }
-  if (!strncasecmp("create", q.c_str(), 6) || !strncasecmp("insert", q.c_str(), 6)) {
-    insert_id = result->records[0];
-    insert_id.type = ORIENT_RECORD_ID;
-  }
-  if (db->verbose() > 1)
-    app_log << "Query returns " << result->records.size() << " records";
+  req.clear();
+  encode(req, query_type);
+  orientrsp rsp = db->send(ORIENTDB_COMMAND, req);
+  parse_result(rsp, result.get());
  }
  catch (boost::system::system_error &e) {
    if (!reconnecting && ((e.code() == boost::asio::error::eof) ||
@@ -411,6 +889,500 @@ restart:
  return result;
 }
 
+orientop orientquery::command_op(int query_type, orientresult_ptr result)
+{
+ // parser keeps its own copy of the query
+ boost::shared_ptr<orientquery> query(new orientquery(db, q));
+ query->fetchplan_ = fetchplan_;
+ orientop op;
+ op.cmd = ORIENTDB_COMMAND;
+ encode(op.req, query_type);
+ query->inserts_ = inserts_;
+ op.parse = boost::bind(&orientquery::parse_result, query, boost::placeholders::_1, result.get());
+ return op;
+}
+
+orientcursor_ptr orientquery::open_cursor(int query_type, bool async)
+{
+ if (!prepared) {
+   if (buf.str().size())
+     text(buf.str());
+   buf.str("");
+ }
+ if (!q.size())
+   db->error("orientquery::cursor(): Empty query");
+ req.clear();
+ encode(req, query_type, async);
+ try {
+   orientrsp rsp = db->send(ORIENTDB_COMMAND, req);
+   return orientcursor_ptr(new orientcursor(db, rsp));
+ }
+ catch (boost::system::system_error &e) {
+   db->error(string("orientquery::cursor(): ") + e.what());
+ }
+ return orientcursor_ptr();
+}
+
+u64 orientquery::execute_each(orientrecord_handler h, int query_type)
+{
+ orientcursor_ptr cur = open_cursor(query_type, true);
+ orient_record_t r;
+ while (cur->next(r))
+   if (!h(r)) {
+     cur->close();
+     break;
+   }
+ return cur->fetched();
+}
+
+orientcursor::orientcursor(orientdb *db, orientrsp &r) : parser(db), rsp(new orientrsp(std::move(r))), status(0),
+  remaining(0), done(false), count(0)
+{
+ try {
+   rsp->parse(&status);
+   switch (status) {
+     case 'l': // collection of records
+       rsp->parse(&remaining);
+       if (!remaining)
+         finish();
+       break;
+     case 'r': // single record
+       remaining = 1;
+       break;
+     case 1:   // async mode stream
+     case 2:
+     case 'a': // serialized result
+       break;
+     case 0:
+     case 'n':
+       finish();
+       break;
+     default:
+       db->error("orientcursor: Unsupported query result [" + itoa(status) + "]");
+   }
+ }
+ catch (...) {
+   // as in next(): the unread rest of the response must not reach the next request
+   if (rsp)
+     rsp->tc->drop();
+   finish();
+   throw;
+ }
+}
+
+orientcursor::~orientcursor()
+{
+ try {
+   close();
+ }
+ catch (std::exception &e) {
+   app_log << "~orientcursor(): " << e.what();
+ }
+}
+
+bool orientcursor::next(orient_record_t &r)
+{
+ try {
+   return read(r);
+ }
+ catch (...) {
+   // stream is out of sync, nothing more can be read: the rest of it must not reach the
+   // next request, the connection is closed before it is unlocked
+   if (rsp)
+     rsp->tc->drop();
+   finish();
+   throw;
+ }
+}
+
+bool orientcursor::read(orient_record_t &r)
+{
+ while (!done) {
+   switch (status) {
+     case 'l':
+     case 'r':
+       r = parser.parse_record(*rsp);
+       if (!--remaining)
+         finish();
+       count++;
+       return true;
+     case 'a':
+      {
+        string res;
+        rsp->parse(&res);
+        r = orient_record_t(res);
+        finish();
+        count++;
+        return true;
+      }
+     case 1:
+     case 2:
+      {
+        orient_record_t rec = parser.parse_record(*rsp);
+        u8 current = status;
+        rsp->parse(&status);
+        if (!status)
+          finish();
+        if (current == 2) { // linked record, not part of the result
+          if (parser.db->cache())
+            parser.db->cache()->put(rec);
+          continue;
+        }
+        r = rec;
+        count++;
+        return true;
+      }
+     default:
+       finish();
+   }
+ }
+ return false;
+}
+
+void orientcursor::close()
+{
+ orient_record_t skip;
+ while (next(skip))
+   ;
+}
+
+static void batch_done(orientresult_ptr result, const string &err)
+{
+ result->error = err;
+}
+
+void orientquery::add_batch(int query_type)
+{
+ if (!prepared) {
+   if (buf.str().size())
+     text(buf.str());
+   buf.str("");
+ }
+ if (!q.size()) // empty query
+   return;
+ if (!batch_)
+   batch_.reset(new orientpipeline(db));
+ orientresult_ptr result(new orientresult(zero_copy_, arena_));
+ orientop op = command_op(query_type, result);
+ op.done = boost::bind(batch_done, result, boost::placeholders::_1);
+ batch_->add(op);
+ batch_results.push_back(result);
+ batch_inserts.push_back(inserts_);
+}
+
+vector <orientresult_ptr> orientquery::execute_batch()
+{
+ vector <orientresult_ptr> results;
+ vector <bool> inserts;
+ results.swap(batch_results);
+ inserts.swap(batch_inserts);
+ batch_ids.clear();
+ if (!results.size())
+   return results;
+ if (db->verbose() > 1)
+   app_log << "orientquery: executing batch of " << results.size() << " statements";
+ // flush() leaves the pipeline empty, even when it throws
+ try {
+   batch_->flush();
+ }
+ catch (Exception &e) {
+   // every statement got its own error
+ }
+ for (size_t i = 0; i < results.size(); i++)
+   batch_ids.push_back((inserts[i] && !results[i]->error.size() && results[i]->records.size()) ?
+     results[i]->records[0].rid : rid_t());
+ return results;
+}
+
+static void complete_result(orientresult_ptr result, orientresult_handler h, const string &err)
+{
+ h(result, err);
+}
+
+void orientquery::execute_async(orientresult_handler h, int query_type)
+{
+ if (!prepared) {
+   if (buf.str().size())
+     text(buf.str());
+   buf.str("");
+ }
+ orientresult_ptr result(new orientresult(zero_copy_, arena_));
+ if (!q.size()) { // empty query
+   h(result, "");
+   return;
+ }
+ if (db->verbose() > 1)
+   app_log << "OrientPP::query async " << q;
+ orientop op = command_op(query_type, result);
+ op.done = boost::bind(complete_result, result, h, boost::placeholders::_1);
+ db->async()->submit(op);
+}
+
+template <typename T> static void set_promise(boost::shared_ptr<boost::promise<T> > p, T v,
+  const string &err)
+{
+ if (err.size())
+   p->set_exception(boost::copy_exception(Exception(err)));
+ else
+   p->set_value(v);
+}
+
+boost::unique_future<orientresult_ptr> orientquery::execute_async(int query_type)
+{
+ boost::shared_ptr<boost::promise<orientresult_ptr> > p(new boost::promise<orientresult_ptr>);
+ boost::unique_future<orientresult_ptr> f = p->get_future();
+ execute_async(boost::bind(set_promise<orientresult_ptr>, p, boost::placeholders::_1,
+   boost::placeholders::_2), query_type);
+ return f;
+}
+
+static void parse_u64(boost::shared_ptr<u64> dst, orientrsp &rsp)
+{
+ rsp.parse(dst.get());
+}
+
+static void complete_u64(boost::shared_ptr<u64> v, orientcount_handler h, const string &err)
+{
+ h(err.size() ? 0 : *v, err);
+}
+
+orientasync *orientdb::async()
+{
+ boost::unique_lock<boost::mutex> lock(a_lock);
+ if (!async_)
+   async_.reset(new orientasync(this));
+ return async_.get();
+}
+
+void orientdb::count_async(orientcount_handler h)
+{
+ boost::shared_ptr<u64> v(new u64(0));
+ orientop op;
+ op.cmd = ORIENTDB_DB_COUNTRECORDS;
+ op.parse = boost::bind(parse_u64, v, boost::placeholders::_1);
+ op.done = boost::bind(complete_u64, v, h, boost::placeholders::_1);
+ async()->submit(op);
+}
+
+void orientdb::size_async(orientcount_handler h)
+{
+ boost::shared_ptr<u64> v(new u64(0));
+ orientop op;
+ op.cmd = ORIENTDB_DB_SIZE;
+ op.parse = boost::bind(parse_u64, v, boost::placeholders::_1);
+ op.done = boost::bind(complete_u64, v, h, boost::placeholders::_1);
+ async()->submit(op);
+}
+
+boost::unique_future<u64> orientdb::count_async()
+{
+ boost::shared_ptr<boost::promise<u64> > p(new boost::promise<u64>);
+ boost::unique_future<u64> f = p->get_future();
+ count_async(boost::bind(set_promise<u64>, p, boost::placeholders::_1, boost::placeholders::_2));
+ return f;
+}
+
+boost::unique_future<u64> orientdb::size_async()
+{
+ boost::shared_ptr<boost::promise<u64> > p(new boost::promise<u64>);
+ boost::unique_future<u64> f = p->get_future();
+ size_async(boost::bind(set_promise<u64>, p, boost::placeholders::_1, boost::placeholders::_2));
+ return f;
+}
+
+orientresult_ptr orientpipeline::command(string qs, int query_type, orientop::completion done)
+{
+ orientquery query(db, qs);
+ orientresult_ptr result(new orientresult);
+ orientop op = query.command_op(query_type, result);
+ op.done = done;
+ ops.push_back(op);
+ return result;
+}
+
+orientresult_ptr orientpipeline::load(rid_t rid, string fetchplan, orientop::completion done)
+{
+ orientresult_ptr result(new orientresult);
+ orientop op;
+ op.cmd = ORIENTDB_RECORD_LOAD;
+ // (cluster-id:short)(cluster-position:long)(fetch-plan:string)(ignore-cache:byte)
+ op.req.append((u16)rid.id);
+ op.req.append((s64)rid.pos);
+ op.req.append(fetchplan);
+ op.req.append((u8)0);
+ op.parse = boost::bind(parse_load, db, rid, result, boost::placeholders::_1);
+ op.done = done;
+ ops.push_back(op);
+ return result;
+}
+
+void orientpipeline::parse_load(orientdb *db, rid_t rid, orientresult_ptr result, orientrsp &rsp)
+{
+ // [(payload-status:byte)[(record-content:bytes)(record-version:int)(record-type:byte)]*]+
+ while (1) {
+   u8 payload_status;
+   rsp.parse(&payload_status);
+   if (!payload_status)
+     break;
+   if (payload_status == 1) {
+     orientbytes content;
+     s32 version;
+     u8 type;
+     rsp.parse(&content, &result->chunks);
+     rsp.parse(&version);
+     rsp.parse(&type);
+     result->records.push_back(orient_record_t(type, rid.id, rid.pos, version, content));
+     if (db->cache())
+       db->cache()->put(result->records.back());
+   } else if (payload_status == 2) {
+     // pre-fetched by the fetch plan, not part of the result
+     orient_record_t r = orientquery(db).parse_record(rsp, result.get());
+     result->prefetched[r.rid] = r;
+     if (db->cache())
+       db->cache()->put(r);
+   } else
+       throw Exception("orientpipeline: Unsupported load result [" + itoa(payload_status) + "]");
+ }
+}
+
+void orientpipeline::flush()
+{
+ if (!ops.size())
+   return;
+ orientsrv *srv = db->srv;
+ bool reconnecting = false, written = false;
+ size_t parsed = 0;
+ vector <string> errors(ops.size());
+ string failure; // fails all the requests without response
+restart:
+ try {
+   boost::unique_lock<boost::recursive_mutex> state(db->s_lock);
+   db->check_connection();
+   boost::unique_lock<boost::mutex> lock(srv->m_lock);
+   try {
+     string &req = srv->wbuf;
+     req.clear();
+     for (size_t i = 0; i < ops.size(); i++)
+       srv->frame(req, ops[i].cmd, ops[i].req, &db->session);
+     srv->tc.write_data(req);
+     written = true;
+     if (db->verbose() > 1)
+       app_log << "orientpipeline: sent " << ops.size() << " requests, " << req.size() << " bytes";
+     if (req.capacity() > (16 * ORIENTPP_CHUNK_SIZE)) // do not keep a huge batch around
+       string().swap(req);
+     for (; parsed < ops.size(); parsed++) {
+       // the last response drops leftovers, the connection stays locked until all are parsed
+       orientrsp rsp(&srv->tc, &db->session, parsed != (ops.size() - 1));
+       try {
+         ops[parsed].parse(rsp);
+       }
+       catch (Exception &e) {
+         // server error is fully read, the stream is still in sync
+         if (rsp.res <= 0)
+           throw;
+         errors[parsed] = e.what();
+       }
+     }
+   }
+   catch (std::exception &e) {
+     // responses of the rest of the batch may still arrive, nobody reads them
+     srv->tc.drop();
+     throw;
+   }
+ }
+ catch (boost::system::system_error &e) {
+   failure = string("orientpipeline::flush(): ") + e.what();
+   // requests never reached the server, safe to send them again
+   if (!written && !reconnecting && ((e.code() == boost::asio::error::eof) ||
+     (e.code() == boost::asio::error::broken_pipe))) {
+       reconnecting = true;
+       try {
+         db->reopen();
+         failure.clear();
+       }
+       catch (std::exception &re) {
+         failure = string("orientpipeline::flush(): ") + re.what();
+       }
+       if (!failure.size())
+         goto restart;
+   }
+ }
+ catch (std::exception &e) {
+   failure = string("orientpipeline::flush(): ") + e.what();
+ }
+ vector <orientop> completed;
+ completed.swap(ops);
+ string first_error;
+ for (size_t i = 0; i < completed.size(); i++) {
+   string &err = (i < parsed) ? errors[i] : failure;
+   if (err.size() && !first_error.size())
+     first_error = err;
+   if (!completed[i].done)
+     continue;
+   try {
+     completed[i].done(err);
+   }
+   catch (std::exception &e) {
+     app_log << "orientpipeline: completion failed: " << e.what();
+   }
+ }
+ if (first_error.size())
+   db->error(first_error);
+}
+
+orientasync::orientasync(orientdb *db_, size_t batch_) : db(db_), stopping(false), batch(batch_)
+{
+ worker = boost::thread(boost::bind(&orientasync::run, this));
+}
+
+void orientasync::submit(const orientop &op)
+{
+ boost::unique_lock<boost::mutex> lock(m_lock);
+ if (stopping) {
+   lock.unlock();
+   if (op.done)
+     op.done("orientasync::submit(): Dispatcher is stopped");
+   return;
+ }
+ queue.push_back(op);
+ m_cond.notify_one();
+}
+
+void orientasync::stop()
+{
+ {
+   boost::unique_lock<boost::mutex> lock(m_lock);
+   stopping = true;
+   m_cond.notify_all();
+ }
+ if (worker.joinable() && (worker.get_id() != boost::this_thread::get_id()))
+   worker.join();
+}
+
+void orientasync::run()
+{
+ while (1) {
+   orientpipeline p(db);
+   {
+     boost::unique_lock<boost::mutex> lock(m_lock);
+     while (!stopping && !queue.size())
+       m_cond.wait(lock);
+     if (!queue.size())
+       return;
+     while (queue.size() && (p.size() < batch)) {
+       p.add(queue.front());
+       queue.pop_front();
+     }
+   }
+   try {
+     p.flush();
+   }
+   catch (std::exception &e) {
+     // already reported to the completions
+   }
+ }
+}
+
 orient_record_t orient_null;
 
 };
@@ -20,10 +20,30 @@ typedef int64_t s64;
 #include <iostream>
 #include <string>
 
+#include <deque>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/lambda/bind.hpp>
 #include <boost/lambda/lambda.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/future.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "capture.h"
 
 using boost::asio::deadline_timer;
 using boost::asio::ip::tcp;
@@ -41,7 +61,9 @@ enum {
 #else
   ORIENTPP_DEFAULT_VERBOSE_LEVEL = 0,
 #endif
-  ORIENTPP_DEFAULT_OPS_TIMEOUT = 5
+  ORIENTPP_DEFAULT_OPS_TIMEOUT = 5,
+  ORIENTPP_DEFAULT_ASYNC_BATCH = 64,
+  ORIENTPP_CHUNK_SIZE = 64 * 1024
 };
 
 #define ORIENTPP_DRIVER_NAME		"OrientPP"
@@ -110,84 +132,223 @@ enum { // record types
 class tcp_client {
   int timeout_seconds;
   bool verbose_;
+  orientcapture *capture_;
+  u32 capture_conn_;
+  string capture_r_, capture_w_; // response read so far, request being written
+  bool capture_parts_;          // pieces of the current response were recorded already
+  s32 capture_sid_;             // session of the response, taken from its first piece
+  size_t read_bytes_;
+  // blocking operation with its deadline, both handlers run in the strand
+  struct op_state {
+    boost::system::error_code ec, timer_ec;
+    op_state() : ec(boost::asio::error::would_block), timer_ec(boost::asio::error::would_block) { }
+  };
 public:
   void verbose(bool v) { verbose_ = v; }
+  void capture(orientcapture *c) { capture_ = c; capture_conn_ = c ? c->connection() : 0; }
   void timeout(int seconds) { timeout_seconds = seconds; }
-  tcp_client() : socket_(io_service_), deadline_(io_service_) {
-    deadline_.expires_at(boost::posix_time::pos_infin);
-    check_deadline();
+  // private event loop, driven by the calling thread
+  tcp_client() : own_io_(new boost::asio::io_service), io_service_(*own_io_), strand_(io_service_),
+    socket_(io_service_), deadline_(io_service_) {
     timeout_seconds = ORIENTPP_DEFAULT_OPS_TIMEOUT;
     verbose_ = false;
+    read_bytes_ = 0;
+    capture_parts_ = false;
+    capture(orientcapture::global());
+  }
+  // external event loop: a call from one of its threads drives the loop itself, other
+  // threads sleep until a loop thread has run the handlers, a context switch per operation
+  // (slower than the private loop, it saves threads when there are many connections)
+  tcp_client(boost::asio::io_service &ios) : io_service_(ios), strand_(io_service_),
+    socket_(io_service_), deadline_(io_service_) {
+    timeout_seconds = ORIENTPP_DEFAULT_OPS_TIMEOUT;
+    verbose_ = false;
+    read_bytes_ = 0;
+    capture_parts_ = false;
+    capture(orientcapture::global());
+  }
+  ~tcp_client() {
+    end_response();
+    boost::system::error_code ignored_ec;
+    socket_.close(ignored_ec);
+    if (own_io_)
+      io_service_.stop();
   }
-  ~tcp_client() { socket_.close(); io_service_.stop(); }
-  void close() { socket_.close(); }
+  void close() { end_response(); socket_.close(); }
+  // stream is out of sync: unread data goes away with the socket, see orientdb::send()
+  void drop() {
+    end_response();
+    flush();
+    boost::system::error_code ignored_ec;
+    socket_.close(ignored_ec);
+  }
+  bool is_open() { return socket_.is_open(); }
   void connect(const string& host, const string &port) {
     tcp::resolver::query query(host, port);
     tcp::resolver::iterator iter = tcp::resolver(io_service_).resolve(query);
-    deadline_.expires_from_now(boost::posix_time::seconds(timeout_seconds));
-    boost::system::error_code ec = boost::asio::error::would_block;
-    boost::asio::async_connect(socket_, iter, var(ec) = _1);
-    do io_service_.run_one(); while (ec == boost::asio::error::would_block);
-    if (ec || !socket_.is_open())
+    op_state st;
+    start_deadline(st);
+    boost::asio::async_connect(socket_, iter, strand_.wrap(boost::bind(&tcp_client::on_complete,
+      this, &st, boost::placeholders::_1)));
+    wait(st);
+    if (st.ec || !socket_.is_open())
       throw boost::system::system_error(
-          ec ? ec : boost::asio::error::operation_aborted);
+          st.ec ? st.ec : boost::asio::error::operation_aborted);
   }
   void do_read(size_t len = 1) {
-    deadline_.expires_from_now(boost::posix_time::seconds(timeout_seconds));
-    boost::system::error_code ec = boost::asio::error::would_block;
-    boost::asio::async_read(socket_, buf_, boost::asio::transfer_at_least(len), var(ec) = _1);
-    do io_service_.run_one(); while (ec == boost::asio::error::would_block);
-    if (ec)
-      throw boost::system::system_error(ec);
+    op_state st;
+    start_deadline(st);
+    boost::asio::async_read(socket_, buf_, boost::asio::transfer_at_least(len),
+      strand_.wrap(boost::bind(&tcp_client::on_complete, this, &st, boost::placeholders::_1)));
+    wait(st);
+    if (st.ec)
+      throw boost::system::system_error(st.ec);
   }
   void read_data(u8 *buf, size_t len) {
     if (len > buf_.size())
       do_read(len - buf_.size());
     const char *data = boost::asio::buffer_cast<const char*>(buf_.data());
-    if (verbose_) {
-      app_log << "read " << len << " bytes";
-      for (unsigned int i = 0; i < len; i++) {
-       if (data[i] < 0x20)
-         app_log << "r:" << i << ":0x" << hex << int(u8(data[i]));
-       else
-         app_log << "r:" << i << ":" << char(data[i]) << " | 0x" << hex << int(u8(data[i]));
-      }
+    if (capture_) {
+      capture_r_.append(data, len);
+      // streamed responses (see orientcursor) are not kept whole
+      if (capture_r_.size() >= ORIENTPP_CHUNK_SIZE)
+        capture_piece(ORIENTPP_CAPTURE_READ_PART);
     }
+    read_bytes_ += len;
     memcpy(buf, data, len);
     buf_.consume(len);
   }
   size_t size() { return buf_.size(); }
   void flush() { buf_.consume(buf_.size()); }
-  void write_data(const string& data) {
-    if (verbose_) {
-      for (unsigned int i = 0; i < data.size(); i++) {
-        if (data[i] < 0x20)
-          app_log << "w:" << i << ":0x" << hex << int(u8(data[i]));
-        else
-          app_log << "w:" << i << ":" << char(data[i]) << " | 0x" << hex << int(u8(data[i]));
-        }
+  void write_data(const string& data) { write_buffers(boost::asio::buffer(data)); }
+  // gather write, no copy of the pieces into one buffer
+  template <typename ConstBufferSequence> void write_buffers(const ConstBufferSequence &bufs) {
+    // previous response was not marked as done (handshake, errors)
+    end_response();
+    if (verbose_)
+      app_log << "write " << boost::asio::buffer_size(bufs) << " bytes";
+    if (capture_) {
+      capture_w_.clear();
+      for (typename ConstBufferSequence::const_iterator b = boost::asio::buffer_sequence_begin(bufs);
+        b != boost::asio::buffer_sequence_end(bufs); b++)
+          capture_w_.append(boost::asio::buffer_cast<const char*>(*b), boost::asio::buffer_size(*b));
+      capture_->record(capture_conn_, frame_session(capture_w_), ORIENTPP_CAPTURE_WRITE,
+        capture_w_.data(), capture_w_.size());
+      if (capture_w_.capacity() > ORIENTPP_CHUNK_SIZE)
+        string().swap(capture_w_);
     }
-    deadline_.expires_from_now(boost::posix_time::seconds(timeout_seconds));
-    boost::system::error_code ec = boost::asio::error::would_block;
-    boost::asio::async_write(socket_, boost::asio::buffer(data), var(ec) = _1);
-    do io_service_.run_one(); while (ec == boost::asio::error::would_block);
-    if (ec)
-      throw boost::system::system_error(ec);
+    op_state st;
+    start_deadline(st);
+    boost::asio::async_write(socket_, bufs,
+      strand_.wrap(boost::bind(&tcp_client::on_complete, this, &st, boost::placeholders::_1)));
+    wait(st);
+    if (st.ec)
+      throw boost::system::system_error(st.ec);
+  }
+  boost::asio::io_service &io_service() { return io_service_; }
+  // response is fully read: one log line and one capture record for the rest of its reads
+  void end_response() {
+    if (verbose_ && read_bytes_)
+      app_log << "read " << read_bytes_ << " bytes";
+    read_bytes_ = 0;
+    if (!capture_ || (!capture_r_.size() && !capture_parts_))
+      return;
+    capture_piece(ORIENTPP_CAPTURE_READ);
   }
 private:
-  void check_deadline() {
-    if (deadline_.expires_at() <= deadline_timer::traits_type::now()) {
+  void capture_piece(u8 dir) {
+    if (!capture_parts_)
+      capture_sid_ = frame_session(capture_r_);
+    capture_->record(capture_conn_, capture_sid_, dir, capture_r_.data(), capture_r_.size());
+    capture_r_.clear();
+    capture_parts_ = (dir == ORIENTPP_CAPTURE_READ_PART);
+  }
+  // (command or status:byte)(session-id:int) starts every frame
+  static s32 frame_session(const string &f) {
+    if (f.size() < 5)
+      return -1;
+    s32 sid;
+    memcpy(&sid, f.data() + 1, sizeof(sid));
+    return ntohl(sid);
+  }
+  void start_deadline(op_state &st) {
+    deadline_.expires_from_now(boost::posix_time::seconds(timeout_seconds));
+    deadline_.async_wait(strand_.wrap(boost::bind(&tcp_client::on_deadline, this, &st,
+      boost::placeholders::_1)));
+  }
+  void on_complete(op_state *st, const boost::system::error_code &ec) {
+    boost::system::error_code ignored_ec;
+    deadline_.cancel(ignored_ec);
+    signal(&st->ec, ec);
+  }
+  void on_deadline(op_state *st, const boost::system::error_code &ec) {
+    if ((st->ec == boost::asio::error::would_block) && (ec != boost::asio::error::operation_aborted)) {
       boost::system::error_code ignored_ec;
       socket_.close(ignored_ec);
-      deadline_.expires_at(boost::posix_time::pos_infin);
     }
-    deadline_.async_wait(bind(&tcp_client::check_deadline, this));
+    signal(&st->timer_ec, ec);
+  }
+  void signal(boost::system::error_code *dst, const boost::system::error_code &ec) {
+    boost::unique_lock<boost::mutex> lock(w_lock);
+    *dst = ec;
+    w_cond.notify_all();
+  }
+  // both the operation and its deadline handler have to be done before st goes away
+  void wait(op_state &st) {
+    if (own_io_) {
+      // loop stops when it runs out of work between the operations
+      io_service_.reset();
+      while ((st.ec == boost::asio::error::would_block) ||
+        (st.timer_ec == boost::asio::error::would_block))
+          io_service_.run_one();
+      return;
+    }
+    if (io_service_.get_executor().running_in_this_thread()) {
+      // called from a handler, the loop may have no other thread to run ours: run it here,
+      // the bounded wait notices handlers that another loop thread has run meanwhile
+      while ((st.ec == boost::asio::error::would_block) ||
+        (st.timer_ec == boost::asio::error::would_block))
+          io_service_.run_one_for(boost::asio::chrono::milliseconds(1));
+      return;
+    }
+    boost::unique_lock<boost::mutex> lock(w_lock);
+    while ((st.ec == boost::asio::error::would_block) ||
+      (st.timer_ec == boost::asio::error::would_block))
+        w_cond.wait(lock);
   }
 
-  boost::asio::io_service io_service_;
+  boost::shared_ptr<boost::asio::io_service> own_io_;
+  boost::asio::io_service &io_service_;
+  boost::asio::io_service::strand strand_;
   tcp::socket socket_;
   deadline_timer deadline_;
   boost::asio::streambuf buf_;
+  boost::mutex w_lock;
+  boost::condition_variable w_cond;
+  friend class orientbench;
+};
+
+// I/O threads driving the sockets of all the connections created on them
+class orientio {
+  boost::asio::io_service io_service_;
+  boost::shared_ptr<boost::asio::io_service::work> work_;
+  boost::thread_group threads;
+  orientio& operator= (const orientio&) = delete;
+  orientio(const orientio &)  = delete;
+  void run() { io_service_.run(); }
+public:
+  orientio(size_t n_threads = 1) : work_(new boost::asio::io_service::work(io_service_)) {
+    while (n_threads--)
+      threads.create_thread(boost::bind(&orientio::run, this));
+  }
+  ~orientio() {
+    work_.reset();
+    io_service_.stop();
+    threads.join_all();
+  }
+  boost::asio::io_service &io_service() { return io_service_; }
+  // process wide loop with one thread, created on first use
+  static orientio &shared();
 };
 
 struct orientsrv_buf {
@@ -195,7 +356,11 @@ struct orientsrv_buf {
   size_t size() { return data.size(); }
   const char *buf() { return data.c_str(); }
   orientsrv_buf() { }
-  orientsrv_buf(string s) { append(s); }
+  orientsrv_buf(const string &s) { append(s); }
+  orientsrv_buf(const char *s) { append(s); }
+  // keeps the capacity, the buffer is reused for the next request
+  void clear() { data.clear(); }
+  void reserve(size_t n) { data.reserve(n); }
   void append(orientsrv_buf &b) {
     u32 len = b.size();
     if (len) {
@@ -206,6 +371,19 @@ struct orientsrv_buf {
       append((s32)len);
     }
   }
+  // nested (bytes) written in place, the length is patched by end_bytes()
+  size_t begin_bytes() {
+    size_t mark = data.size();
+    append((s32)0);
+    return mark;
+  }
+  void end_bytes(size_t mark) {
+    u32 len = data.size() - mark - sizeof(s32);
+    if (!len)
+      len = ORIENT_NULL;
+    len = htonl(len);
+    memcpy(&data[mark], &len, sizeof(len));
+  }
   void append(s32 val) {
     val = htonl(val);
     data.append((const char *)&val, sizeof(val));
@@ -217,6 +395,10 @@ struct orientsrv_buf {
   void append(u8 val) {
     data.append((const char *)&val, 1);
   }
+  void append(s64 val) {
+    val = htobe64(val);
+    data.append((const char *)&val, sizeof(val));
+  }
   string safe_quote(string s) {
    for (uint i = 0; i < s.size(); i++) {
      if ((s[i] == '"') || (s[i] == '\\'))
@@ -224,12 +406,12 @@ struct orientsrv_buf {
    }
    return s;
   }
-  void append(string s) {
-    string quoted(s);
-    u32 len = quoted.size();
+  void append(const string &s) { append(s.data(), s.size()); }
+  void append(const char *s) { append(s, strlen(s)); }
+  void append(const char *s, u32 len) {
     if (len) {
       append((s32)len);
-      data.append(quoted.c_str(), len);
+      data.append(s, len);
     } else {
       len = ORIENT_NULL;
       append((s32)len);
@@ -237,6 +419,176 @@ struct orientsrv_buf {
   }
 };
 
+// refcounted block of received bytes
+struct orientchunk {
+  char *data;
+  size_t size, used;
+  orientchunk(size_t n) : data(new char[n]), size(n), used(0) { }
+  ~orientchunk() { delete [] data; }
+  char *alloc(size_t n) {
+    if ((used + n) > size)
+      return 0;
+    char *p = data + used;
+    used += n;
+    return p;
+  }
+private:
+  orientchunk& operator= (const orientchunk&) = delete;
+  orientchunk(const orientchunk &)  = delete;
+};
+
+typedef boost::shared_ptr<orientchunk> orientchunk_ptr;
+
+// monotonic allocator of one result, the memory is given back in one go when the result
+// and every record copied out of it are gone. Not thread safe, neither is the result.
+class orientarena {
+  vector <orientchunk_ptr> blocks;
+  orientarena& operator= (const orientarena&) = delete;
+  orientarena(const orientarena &)  = delete;
+public:
+  orientarena() { }
+  void *alloc(size_t n) {
+    n = (n + 7) & ~(size_t)7;
+    char *p = blocks.size() ? blocks.back()->alloc(n) : 0;
+    if (!p) {
+      blocks.push_back(boost::make_shared<orientchunk>(max(n, (size_t)ORIENTPP_CHUNK_SIZE)));
+      p = blocks.back()->alloc(n);
+    }
+    return p;
+  }
+  size_t allocated() {
+    size_t n = 0;
+    for (size_t i = 0; i < blocks.size(); i++)
+      n += blocks[i]->size;
+    return n;
+  }
+};
+
+typedef boost::shared_ptr<orientarena> orientarena_ptr;
+
+// std allocator on top of an orientarena, plain heap when there is none
+template <typename T> struct orientarena_allocator {
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+  orientarena_ptr arena;
+  orientarena_allocator() { }
+  orientarena_allocator(const orientarena_ptr &a) : arena(a) { }
+  template <typename U> orientarena_allocator(const orientarena_allocator<U> &a) : arena(a.arena) { }
+  T *allocate(size_t n) {
+    return (T *)(arena ? arena->alloc(n * sizeof(T)) : ::operator new(n * sizeof(T)));
+  }
+  void deallocate(T *p, size_t) {
+    if (!arena)
+      ::operator delete(p);
+  }
+  template <typename U> bool operator==(const orientarena_allocator<U> &a) const { return arena == a.arena; }
+  template <typename U> bool operator!=(const orientarena_allocator<U> &a) const { return arena != a.arena; }
+};
+
+// view of received bytes, keeps its chunk alive
+struct orientbytes {
+  const char *ptr;
+  size_t len;
+  orientchunk_ptr chunk;
+  orientbytes() : ptr(""), len(0) { }
+  orientbytes(const string &s) : ptr(""), len(s.size()) {
+    if (len) {
+      chunk = boost::make_shared<orientchunk>(len);
+      char *p = chunk->alloc(len);
+      memcpy(p, s.data(), len);
+      ptr = p;
+    }
+  }
+  size_t size() const { return len; }
+  const char *data() const { return ptr; }
+  // like string, past the end reads as 0
+  char operator[](size_t i) const { return (i < len) ? ptr[i] : 0; }
+  string str() const { return string(ptr, len); }
+};
+
+// storage for received record contents, in zero copy mode the records of one result
+// share big chunks instead of owning an allocation each
+struct orientchunks {
+  bool shared;
+  orientchunk_ptr current;
+  orientchunks(bool shared_ = false) : shared(shared_) { }
+  char *alloc(size_t len, orientchunk_ptr &holder) {
+    if (!shared || (len > (ORIENTPP_CHUNK_SIZE / 4))) {
+      holder = boost::make_shared<orientchunk>(len);
+      return holder->alloc(len);
+    }
+    char *p = current ? current->alloc(len) : 0;
+    if (!p) {
+      current = boost::make_shared<orientchunk>(ORIENTPP_CHUNK_SIZE);
+      p = current->alloc(len);
+    }
+    holder = current;
+    return p;
+  }
+};
+
+struct rid_t {
+  s16 id;
+  s64 pos;
+  bool valid;
+  rid_t () : id(-1), pos(-1), valid(false) { }
+  rid_t (s16 id_, s64 pos_) : id(id_), pos(pos_), valid(true) { }
+  // not yet committed record of a transaction
+  bool is_temporary() const { return valid && (pos < -1); }
+  bool operator<(const rid_t &r) const { return (id < r.id) || ((id == r.id) && (pos < r.pos)); }
+  bool operator==(const rid_t &r) const { return (id == r.id) && (pos == r.pos) && (valid == r.valid); }
+  string str() const {
+    if (!valid)
+      return "";
+    stringstream ss;
+    ss << id << ":" << pos;
+    return ss.str();
+  }
+  operator string() const {
+    if (!valid)
+      return "";
+    stringstream ss;
+    ss << "#" << id << ":" << pos;
+    return ss.str();
+  }
+};
+
+enum {
+  ORIENT_TX_UPDATE = 1,
+  ORIENT_TX_DELETE,
+  ORIENT_TX_CREATE
+};
+
+// cluster as reported by DB_OPEN / DB_RELOAD
+struct orientcluster {
+  string name;
+  s16 id;
+  string type;
+  s16 data_segment;
+};
+
+// operation buffered by orientdb::begin() until commit()
+struct orienttx_entry {
+  u8 op;
+  rid_t rid;
+  u8 type;
+  s32 version;
+  string content;
+};
+
+// outcome of orientdb::commit()
+struct orienttx_result {
+  map <rid_t, rid_t> created;   // temporary -> assigned
+  map <rid_t, s32> versions;    // updated record -> new version
+  // assigned rid of a temporary one, others are returned as is
+  rid_t rid(const rid_t &r) const {
+    map <rid_t, rid_t>::const_iterator it = created.find(r);
+    return (it == created.end()) ? r : it->second;
+  }
+};
+
 struct orientsession {
   s32 id;
   bool connected;
@@ -247,12 +599,30 @@ struct orientrsp {
   tcp_client *tc;
   orientsession *session;
   s8 res;
+  // connection state of the database (see orientdb::send()), released after the connection
+  boost::unique_lock<boost::recursive_mutex> state_lock;
+  // connection stays locked until the response is parsed
+  boost::unique_lock<boost::mutex> lock;
+  // more responses follow in the buffer, do not drop them
+  bool pipelined;
   ~orientrsp() {
+    if (!tc)
+      return;
+    tc->end_response();
+    if (pipelined)
+      return;
     if (tc->size())
       app_log << "*** Ignoring " << tc->size() << " non-parsed bytes of the response";
     tc->flush();
   }
-  orientrsp(tcp_client *tc_, orientsession *session_) : tc(tc_), session(session_), res(-1) { }
+  orientrsp(tcp_client *tc_, orientsession *session_, bool pipelined_ = false) : tc(tc_),
+    session(session_), res(-1), pipelined(pipelined_) { }
+  orientrsp(tcp_client *tc_, orientsession *session_, boost::unique_lock<boost::mutex> &lock_) :
+    tc(tc_), session(session_), res(-1), lock(std::move(lock_)), pipelined(false) { }
+  orientrsp(orientrsp &&r) : tc(r.tc), session(r.session), res(r.res),
+    state_lock(std::move(r.state_lock)), lock(std::move(r.lock)), pipelined(r.pipelined) {
+    r.tc = 0;
+  }
   void check_result() {
     if (res >= 0)
       return;
@@ -297,9 +667,8 @@ struct orientrsp {
     u32 len;
     parse(&len);
     if (len && (len != ORIENT_NULL)) {
-      u8 buf[len];
-      tc->read_data(buf, len);
-      *dst = string((const char*)buf, len);
+      dst->resize(len);
+      tc->read_data((u8 *)&(*dst)[0], len);
     }
   }
   // bytes
@@ -308,9 +677,22 @@ struct orientrsp {
     u32 len;
     parse(&len);
     if (len && (len != ORIENT_NULL)) { // WTF ? the NULL value must have 0 len, not -1
-      u8 buf[len];
-      tc->read_data(buf, len);
-      dst->data = string((const char*)buf, len);
+      dst->data.resize(len);
+      tc->read_data((u8 *)&dst->data[0], len);
+    }
+  }
+  // bytes, read straight into the chunk storage
+  void parse(orientbytes *dst, orientchunks *chunks = 0) {
+    check_result();
+    u32 len;
+    parse(&len);
+    *dst = orientbytes();
+    if (len && (len != ORIENT_NULL)) {
+      orientchunks own;
+      char *p = (chunks ? chunks : &own)->alloc(len, dst->chunk);
+      tc->read_data((u8 *)p, len);
+      dst->ptr = p;
+      dst->len = len;
     }
   }
   string parse_error() {
@@ -338,6 +720,7 @@ class orientsrv {
   orientsession session;
   u16 protocol;
   string url, user, pass, host, port;
+  string wbuf; // pipelined requests, reused under m_lock
   tcp_client tc;
   void init() {
     verbose(ORIENTPP_DEFAULT_VERBOSE_LEVEL);
@@ -345,15 +728,24 @@ class orientsrv {
     port = ORIENTDB_SERVER_PORT;
     protocol = 0;
   }
-  orientrsp send(u8 cmd, orientsrv_buf &r, orientsession *s = 0) {
-    boost::unique_lock<boost::mutex> lock(m_lock);
-    string req((const char *)&cmd, 1);
+  // (command:byte)(session-id:int)(payload)
+  void frame(string &req, u8 cmd, orientsrv_buf &r, orientsession *s) {
+    req.append((const char *)&cmd, 1);
     s32 sid = htonl(s ? s->id : session.id);
     req.append((const char *)&sid, sizeof(sid));
     if (r.size())
       req.append(r.buf(), r.size());
-    tc.write_data(req);
-    return orientrsp(&tc, s ? s : &session);
+  }
+  orientrsp send(u8 cmd, orientsrv_buf &r, orientsession *s = 0) {
+    boost::unique_lock<boost::mutex> lock(m_lock);
+    u8 hdr[sizeof(u8) + sizeof(s32)];
+    hdr[0] = cmd;
+    s32 sid = htonl(s ? s->id : session.id);
+    memcpy(hdr + 1, &sid, sizeof(sid));
+    boost::array<boost::asio::const_buffer, 2> bufs = { {
+      boost::asio::buffer(hdr), boost::asio::buffer(r.buf(), r.size()) } };
+    tc.write_buffers(bufs);
+    return orientrsp(&tc, s ? s : &session, lock);
   }
   void error(string err) {
     if (verbose())
@@ -376,6 +768,10 @@ class orientsrv {
   void createdb(string db, int db_type, int db_engine);
   void connect(string _url, string user = "", string pass = "");
   orientsrv(string _url, string user = "", string pass = "") { init(); connect(_url, user, pass); }
+  // socket is driven by the external event loop (see orientio)
+  orientsrv(boost::asio::io_service &ios, string _url, string user = "", string pass = "") :
+    tc(ios) { init(); connect(_url, user, pass); }
+  orientsrv(boost::asio::io_service &ios) : tc(ios) { init(); }
   void shutdown() {
     if (verbose())
       app_log << "orientsrv::shutdown() called for [" << session.id << "]";
@@ -392,21 +788,54 @@ class orientsrv {
   ~orientsrv();
   friend class orientdb;
   friend class orientrsp;
+  friend class orientpipeline;
+  friend class orientbench;
 };
 
+class orientasync;
+class orientcache;
+struct orient_record_t;
+struct orientresult;
+typedef boost::shared_ptr<orientresult> orientresult_ptr;
+// async completions, empty error string means success
+typedef boost::function<void (u64, const string &)> orientcount_handler;
+typedef boost::function<void (orientresult_ptr, const string &)> orientresult_handler;
+
 class orientdb {
   orientsrv *srv;
   int db_type;
   string db, user, pass;
   orientsession session;
+  // session and reconnects: held by every request from send() until its response is parsed,
+  // so the async dispatcher and the callers never reopen under each other's request
+  boost::recursive_mutex s_lock;
+  boost::mutex a_lock;
+  boost::shared_ptr<orientasync> async_;
+  // client side transaction
+  bool tx_active;
+  s32 tx_seq;
+  s64 tx_next_pos;
+  vector <orienttx_entry> tx_ops;
+  orientcache *cache_;
+  // cluster catalog
+  vector <orientcluster> clusters_;
+  map <string, s16> cluster_ids_;
+  map <string, vector <s16> > class_clusters_;
+  bool parse_clusters(orientrsp &rsp);
   void reconnect() {
     app_log << "Lost SRV connection, reconnecting";
     session.connected = false;
     session.id = -1;
     srv->reopen();
   }
+  // connection dropped after a broken response is reopened on the next request
+  void check_connection() {
+    if (session.connected && !srv->tc.is_open())
+      reopen();
+  }
  public:
   void reopen() {
+    boost::unique_lock<boost::recursive_mutex> state(s_lock);
     app_log << "Lost DB connection, reopening";
     reconnect();
     open(db, db_type, user, pass);
@@ -414,16 +843,67 @@ class orientdb {
   void open(string db_, int db_type_, string u, string p);
   u64 count();
   u64 size();
+  // first and last record positions of a cluster, -1 both when it is empty
+  void cluster_range(s16 cluster_id, s64 &begin, s64 &end);
+  u64 cluster_count(const vector <s16> &cluster_ids);
+  u64 cluster_count(s16 cluster_id) { return cluster_count(vector <s16>(1, cluster_id)); }
+  u64 cluster_count(const string &class_name) { return cluster_count(class_clusters(class_name)); }
+  // cluster catalog, filled by open() and refreshed by reload()
+  void reload();
+  const vector <orientcluster> &clusters() { return clusters_; }
+  s16 cluster_id(const string &name); // -1 - unknown
+  const orientcluster *cluster(s16 id);
+  // clusters of a class: the registered ones, otherwise the cluster named after the class
+  vector <s16> class_clusters(const string &class_name);
+  void class_clusters(const string &class_name, const vector <s16> &ids);
+  // queued to the async dispatcher, completed from its thread
+  void count_async(orientcount_handler h);
+  void size_async(orientcount_handler h);
+  boost::unique_future<u64> count_async();
+  boost::unique_future<u64> size_async();
+  orientasync *async();
+  // transactions: operations are buffered locally and sent in a single TX_COMMIT,
+  // created records get temporary rids (negative positions) usable as links until then
+  void begin();
+  // a lost connection is reported, not retried: the outcome of the transaction is unknown then
+  orienttx_result commit();
+  void rollback();
+  bool in_tx() { return tx_active; }
+  rid_t tx_create(s16 cluster_id, const string &content, u8 type = ORIENT_DOCUMENT_RECORD);
+  void tx_update(const rid_t &rid, s32 version, const string &content,
+    u8 type = ORIENT_DOCUMENT_RECORD);
+  void tx_remove(const rid_t &rid, s32 version);
+  // direct record access by rid, no SQL involved; inside a transaction
+  // create/update/remove are buffered until commit()
+  orient_record_t load(const rid_t &rid, const string &fetchplan = "");
+  orient_record_t create(s16 cluster_id, const string &content, u8 type = ORIENT_DOCUMENT_RECORD);
+  // into the default cluster of the class
+  orient_record_t create(const string &class_name, const string &content,
+    u8 type = ORIENT_DOCUMENT_RECORD);
+  orient_record_t update(const rid_t &rid, s32 version, const string &content,
+    u8 type = ORIENT_DOCUMENT_RECORD);
+  bool remove(const rid_t &rid, s32 version);
+  // loaded and prefetched records are kept there, writes done here invalidate them
+  void cache(orientcache *c) { cache_ = c; }
+  orientcache *cache() { return cache_; }
   void close();
-  orientrsp send(u8 cmd) { orientsrv_buf dummy; return srv->send(cmd, dummy, &session); }
-  orientrsp send(u8 cmd, orientsrv_buf &r, orientsession *s = 0) { return srv->send(cmd, r, s ? s : &session); }
+  orientrsp send(u8 cmd) { orientsrv_buf dummy; return send(cmd, dummy); }
+  orientrsp send(u8 cmd, orientsrv_buf &r, orientsession *s = 0) {
+    boost::unique_lock<boost::recursive_mutex> state(s_lock);
+    check_connection();
+    orientrsp rsp = srv->send(cmd, r, s ? s : &session);
+    rsp.state_lock = std::move(state);
+    return rsp;
+  }
   void error(string err) { srv->error(err); }
   int verbose() { return srv->verbose(); }
   void verbose(int v) { srv->verbose(v); }
   bool isconnected() { return session.connected; }
-  orientdb(orientsrv &s) : srv(&s) { }
-  orientdb(orientsrv *s) : srv(s) { }
+  orientdb(orientsrv &s) : srv(&s), tx_active(false), tx_seq(0), tx_next_pos(-2), cache_(0) { }
+  orientdb(orientsrv *s) : srv(s), tx_active(false), tx_seq(0), tx_next_pos(-2), cache_(0) { }
   ~orientdb();
+  friend class orientpipeline;
+  friend class orientasync;
 };
 
 enum {
@@ -448,10 +928,168 @@ enum {
  ORIENT_RECORD_TYPE_NULL
 };
 
+
+// view of document bytes, field names and raw values point into the record content
+struct orientstr {
+  const char *ptr;
+  u32 len;
+  orientstr() : ptr(""), len(0) { }
+  orientstr(const char *p, u32 l) : ptr(p), len(l) { }
+  size_t size() const { return len; }
+  const char *data() const { return ptr; }
+  string str() const { return string(ptr, len); }
+  operator string() const { return str(); }
+  bool operator==(const char *s) const { return !strncmp(ptr, s, len) && !s[len]; }
+  bool operator==(const string &s) const { return (s.size() == len) && !memcmp(ptr, s.data(), len); }
+  bool operator!=(const char *s) const { return !(*this == s); }
+  bool operator!=(const string &s) const { return !(*this == s); }
+};
+
+static inline ostream &operator<<(ostream &os, const orientstr &s)
+{
+  return os.write(s.ptr, s.len);
+}
+
+enum {
+  ORIENT_FIELD_ESCAPED = 1 // string value has backslash escapes
+};
+
+#define ORIENT_NO_FIELD		0xFFFFFFFF
+
+// from_chars() alike, no locale, no allocation, false if [p, e) is not a number
+// or does not fit a long
+static inline bool orient_decode_int(const char *p, const char *e, s64 &v)
+{
+  bool neg = (p < e) && (*p == '-');
+  if (neg || ((p < e) && (*p == '+')))
+    p++;
+  if (p == e)
+    return false;
+  u64 r = 0, max = neg ? (u64(1) << 63) : (u64(1) << 63) - 1;
+  for (; p < e; p++) {
+    if ((*p < '0') || (*p > '9'))
+      return false;
+    u32 d = *p - '0';
+    if (r > (max - d) / 10)
+      return false;
+    r = r * 10 + d;
+  }
+  v = neg ? (s64)(0 - r) : (s64)r;
+  return true;
+}
+
+static inline bool orient_decode_float(const char *p, const char *e, double &v)
+{
+  static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  const char *b = p;
+  bool neg = (p < e) && (*p == '-');
+  if (neg || ((p < e) && (*p == '+')))
+    p++;
+  u64 m = 0;
+  int digits = 0, exp = 0;
+  bool any = false;
+  for (; (p < e) && (*p >= '0') && (*p <= '9'); p++, any = true)
+    if (digits < 19) {
+      m = m * 10 + (*p - '0');
+      if (m)
+        digits++;
+    } else
+        exp++;
+  if ((p < e) && (*p == '.'))
+    for (p++; (p < e) && (*p >= '0') && (*p <= '9'); p++, any = true)
+      if (digits < 19) {
+        m = m * 10 + (*p - '0');
+        if (m)
+          digits++;
+        exp--;
+      }
+  if (!any)
+    return false;
+  if ((p < e) && ((*p == 'E') || (*p == 'e'))) {
+    s64 x;
+    if (!orient_decode_int(p + 1, e, x))
+      return false;
+    exp += x;
+    p = e;
+  }
+  if (p != e)
+    return false;
+  // exact when both the mantissa and the power of ten fit a double
+  if ((m < (1ULL << 53)) && (exp >= -22) && (exp <= 22)) {
+    v = (exp < 0) ? (double)m / pow10[-exp] : (double)m * pow10[exp];
+    if (neg)
+      v = -v;
+    return true;
+  }
+  char tmp[64];
+  if ((e - b) >= (ptrdiff_t)sizeof(tmp))
+    return false;
+  memcpy(tmp, b, e - b);
+  tmp[e - b] = 0;
+  v = strtod(tmp, 0);
+  return true;
+}
+
+// first of c1, c2, c3 in [p, e) or e, 32 or 16 bytes per step where the CPU allows it
+static inline const char *orient_scan(const char *p, const char *e, char c1, char c2, char c3)
+{
+#ifdef __AVX2__
+  const __m256i w1 = _mm256_set1_epi8(c1), w2 = _mm256_set1_epi8(c2), w3 = _mm256_set1_epi8(c3);
+  for (; (e - p) >= 32; p += 32) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)p);
+    u32 m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(d, w1),
+      _mm256_cmpeq_epi8(d, w2)), _mm256_cmpeq_epi8(d, w3)));
+    if (m)
+      return p + __builtin_ctz(m);
+  }
+#endif
+#ifdef __SSE2__
+  const __m128i v1 = _mm_set1_epi8(c1), v2 = _mm_set1_epi8(c2), v3 = _mm_set1_epi8(c3);
+  for (; (e - p) >= 16; p += 16) {
+    __m128i d = _mm_loadu_si128((const __m128i *)p);
+    u32 m = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(d, v1),
+      _mm_cmpeq_epi8(d, v2)), _mm_cmpeq_epi8(d, v3)));
+    if (m)
+      return p + __builtin_ctz(m);
+  }
+#endif
+  for (; p < e; p++)
+    if ((*p == c1) || (*p == c2) || (*p == c3))
+      return p;
+  return e;
+}
+
+// value decoded once by the parser, the member in use is given by the field type
+union orientvalue {
+  s64 i;        // byte, short, int, long, date, datetime (ms since epoch)
+  double d;     // float, double, bigdecimal
+  bool b;
+  struct {
+    s16 id;
+    s64 pos;
+  } link;
+};
+
+// entry of the flat field table, offsets are into the record content
+struct orientfield {
+  u32 name_off, name_len;
+  u32 val_off, val_len;
+  u32 next;     // next field on the same level
+  u32 child;    // first element of a collection
+  orientvalue value;
+  u8 type;
+  u8 flags;
+};
+
 //    => use boost:graph
 struct property_t {
-  string name, data;
+  orientstr name;
+  orientstr raw; // value as serialized, without quotes or type suffix
   u8 type;
+  u8 flags;
+  orientvalue value;
+  orientchunk_ptr chunk; // keeps name and raw valid
   string type2str() {
     switch (type) {
       case ORIENT_RECORD_TYPE_BOOL:
@@ -493,244 +1131,471 @@ struct property_t {
     }
       return "unknown:" + itoa(type);
   }
-  // union val { ... }
   // vector <rid_t> links;
   vector <property_t> embedded; // for arrays, maps, etc.
-  property_t(string n) : name(n), type(ORIENT_RECORD_TYPE_UNKNOWN) { }
-  property_t() : type(ORIENT_RECORD_TYPE_UNKNOWN) { }
+  property_t() : type(ORIENT_RECORD_TYPE_UNKNOWN), flags(0) { value.i = 0; }
   operator string () {
-    return data;
+    if (!(flags & ORIENT_FIELD_ESCAPED))
+      return raw.str();
+    string s;
+    s.reserve(raw.size());
+    for (u32 i = 0; i < raw.size(); i++) {
+      if ((raw.ptr[i] == '\\') && ((i + 1) < raw.size()))
+        i++;
+      s += raw.ptr[i];
+    }
+    return s;
   }
   operator int() {
-    if (type == ORIENT_RECORD_TYPE_INT)
-      return atoi(data.c_str());
-    throw Exception("property_t::int(): Invalid type [" + itoa(type) + "] !");
+    if (type != ORIENT_RECORD_TYPE_INT)
+      throw Exception("property_t::int(): Invalid type [" + itoa(type) + "] !");
+    return value.i;
   }
-  // TODO: operator bool, float, ...
+  bool is_integral() {
+    switch (type) {
+      case ORIENT_RECORD_TYPE_BYTE:
+      case ORIENT_RECORD_TYPE_SHORT:
+      case ORIENT_RECORD_TYPE_INT:
+      case ORIENT_RECORD_TYPE_LONG:
+      case ORIENT_RECORD_TYPE_DATE:
+      case ORIENT_RECORD_TYPE_DATETIME:
+        return true;
+    }
+    return false;
+  }
+  bool is_real() {
+    return (type == ORIENT_RECORD_TYPE_FLOAT) || (type == ORIENT_RECORD_TYPE_DOUBLE) ||
+      (type == ORIENT_RECORD_TYPE_BIGDECIMAL);
+  }
+  bool is_null() { return type == ORIENT_RECORD_TYPE_NULL; }
+  // typed accessors, integral and real values convert to each other
+  s64 as_long() {
+    if (is_integral())
+      return value.i;
+    if (is_real())
+      return (s64)value.d;
+    throw Exception("property_t::as_long(): Invalid type [" + type2str() + "] !");
+  }
+  s32 as_int() { return (s32)as_long(); }
+  s16 as_short() { return (s16)as_long(); }
+  s8 as_byte() { return (s8)as_long(); }
+  double as_double() {
+    if (is_real())
+      return value.d;
+    if (is_integral())
+      return (double)value.i;
+    throw Exception("property_t::as_double(): Invalid type [" + type2str() + "] !");
+  }
+  float as_float() { return (float)as_double(); }
+  bool as_bool() {
+    if (type != ORIENT_RECORD_TYPE_BOOL)
+      throw Exception("property_t::as_bool(): Invalid type [" + type2str() + "] !");
+    return value.b;
+  }
+  // milliseconds since epoch
+  s64 as_date() {
+    if ((type != ORIENT_RECORD_TYPE_DATE) && (type != ORIENT_RECORD_TYPE_DATETIME))
+      throw Exception("property_t::as_date(): Invalid type [" + type2str() + "] !");
+    return value.i;
+  }
+  s64 as_datetime() { return as_date(); }
+  rid_t as_link() {
+    if (type != ORIENT_RECORD_TYPE_LINK)
+      throw Exception("property_t::as_link(): Invalid type [" + type2str() + "] !");
+    return rid_t(value.link.id, value.link.pos);
+  }
+  string as_string() { return *this; }
 };
 
-typedef map <string, property_t>::iterator property_iterator;
-
-struct rid_t {
-  s16 id;
-  s64 pos;
-  bool valid;
-  rid_t () : id(-1), pos(-1), valid(false) { }
-  rid_t (s16 id_, s64 pos_) : id(id_), pos(pos_), valid(true) { }
-  string str() {
-    if (!valid)
-      return "";
-    stringstream ss;
-    ss << id << ":" << pos;
-    return ss.str();
+// top level properties of a document, flat field table underneath
+struct orientfields {
+  typedef vector <orientfield, orientarena_allocator<orientfield> > table_t;
+  table_t table;
+  orientbytes content;
+  u32 first, last, count;
+  orientfields() : first(ORIENT_NO_FIELD), last(ORIENT_NO_FIELD), count(0) { }
+  void clear() {
+    table.clear();
+    first = last = ORIENT_NO_FIELD;
+    count = 0;
   }
-  operator string() {
-    if (!valid)
-      return "";
-    stringstream ss;
-    ss << "#" << id << ":" << pos;
-    return ss.str();
+  u32 add(u32 name_off, u32 name_len) {
+    orientfield f;
+    f.name_off = name_off;
+    f.name_len = name_len;
+    f.val_off = f.val_len = 0;
+    f.next = f.child = ORIENT_NO_FIELD;
+    f.type = ORIENT_RECORD_TYPE_UNKNOWN;
+    f.flags = 0;
+    f.value.i = 0;
+    table.push_back(f);
+    return table.size() - 1;
   }
+  // links a top level field
+  void append(u32 idx) {
+    if (last == ORIENT_NO_FIELD)
+      first = idx;
+    else
+      table[last].next = idx;
+    last = idx;
+    count++;
+  }
+  u32 lookup(const char *n, size_t len) const {
+    for (u32 i = first; i != ORIENT_NO_FIELD; i = table[i].next) {
+      const orientfield &f = table[i];
+      if ((f.name_len == len) && !memcmp(content.data() + f.name_off, n, len))
+        return i;
+    }
+    return ORIENT_NO_FIELD;
+  }
+  orientstr name(u32 idx) const {
+    return orientstr(content.data() + table[idx].name_off, table[idx].name_len);
+  }
+  property_t property(u32 idx) const {
+    const orientfield &f = table[idx];
+    property_t p;
+    p.name = name(idx);
+    p.raw = orientstr(content.data() + f.val_off, f.val_len);
+    p.type = f.type;
+    p.flags = f.flags;
+    p.value = f.value;
+    p.chunk = content.chunk;
+    for (u32 c = f.child; c != ORIENT_NO_FIELD; c = table[c].next)
+      p.embedded.push_back(property(c));
+    return p;
+  }
+  class iterator {
+    const orientfields *fields;
+    u32 idx;
+    pair <orientstr, property_t> cur;
+  public:
+    iterator(const orientfields *f, u32 i) : fields(f), idx(i) { }
+    pair <orientstr, property_t> &operator*() {
+      cur.first = fields->name(idx);
+      cur.second = fields->property(idx);
+      return cur;
+    }
+    pair <orientstr, property_t> *operator->() { return &(**this); }
+    iterator &operator++() { idx = fields->table[idx].next; return *this; }
+    iterator operator++(int) { iterator it(*this); ++(*this); return it; }
+    bool operator==(const iterator &it) const { return idx == it.idx; }
+    bool operator!=(const iterator &it) const { return idx != it.idx; }
+  };
+  iterator begin() const { return iterator(this, first); }
+  iterator end() const { return iterator(this, ORIENT_NO_FIELD); }
+  iterator find(const string &n) const { return iterator(this, lookup(n.data(), n.size())); }
+  size_t size() const { return count; }
 };
 
+typedef orientfields::iterator property_iterator;
+
 struct orient_record_t {
   u8 type;
   rid_t rid;
   s32 version;
-  string content;
+  orientbytes content;
   bool parsed;
   string class_;
-  // and what if property can be without the name ?
-  // replace with vector <property_t> ?
-  map <string, property_t> properties;
+  // flat field table, one allocation per document
+  orientfields properties;
   orient_record_t(string &serialized) :
     type(ORIENT_SERIALIZED_RECORD), content(serialized), parsed(false) { }
   orient_record_t(s16 id_, s64 pos_) :
     type(ORIENT_RECORD_ID), rid(id_, pos_), parsed(false) { }
-  orient_record_t(u8 type_, s16 id_, s64 pos_, s32 version_, string &content_) :
+  orient_record_t(u8 type_, s16 id_, s64 pos_, s32 version_, const orientbytes &content_) :
     type(type_),
     rid(id_, pos_),
     version(version_),
     content(content_),
     parsed(false) { }
   orient_record_t() : type(ORIENT_NULL_RECORD) { }
-  bool has_property(string n) {
+  // field table of the parsed document is taken from the arena
+  void use_arena(const orientarena_ptr &arena) {
+    properties.table = orientfields::table_t(orientarena_allocator<orientfield>(arena));
+  }
+  bool has_property(const string &n) {
     parse();
-    property_iterator it = properties.find(n);
-    return (it == properties.end()) ? false : true;
+    return properties.lookup(n.data(), n.size()) != ORIENT_NO_FIELD;
   }
-  property_t get_property(string n) {
+  property_t get_property(const string &n) {
     parse();
-    property_iterator it = properties.find(n);
-    if (it == properties.end())
+    u32 idx = properties.lookup(n.data(), n.size());
+    if (idx == ORIENT_NO_FIELD)
       throw Exception("No such property: " + n);
-    return it->second;
+    return properties.property(idx);
+  }
+  // converts the raw value of scalar types once, so typed reads do not reparse it
+  void decode(orientfield &f) {
+    if (!f.val_len) // empty, the value stays 0
+      return;
+    const char *b = content.data() + f.val_off, *e = b + f.val_len;
+    bool ok = true;
+    switch (f.type) {
+      case ORIENT_RECORD_TYPE_BYTE:
+      case ORIENT_RECORD_TYPE_SHORT:
+      case ORIENT_RECORD_TYPE_INT:
+      case ORIENT_RECORD_TYPE_LONG:
+      case ORIENT_RECORD_TYPE_DATE:
+      case ORIENT_RECORD_TYPE_DATETIME:
+        ok = orient_decode_int(b, e, f.value.i);
+        break;
+      case ORIENT_RECORD_TYPE_FLOAT:
+      case ORIENT_RECORD_TYPE_DOUBLE:
+      case ORIENT_RECORD_TYPE_BIGDECIMAL:
+        ok = orient_decode_float(b, e, f.value.d);
+        break;
+      case ORIENT_RECORD_TYPE_BOOL:
+        f.value.b = (*b == 't');
+        break;
+      case ORIENT_RECORD_TYPE_LINK: {
+        const char *c = (const char *)memchr(b, ':', e - b);
+        s64 id;
+        ok = c && orient_decode_int(b, c, id) && orient_decode_int(c + 1, e, f.value.link.pos);
+        f.value.link.id = ok ? id : -1;
+        break;
+      }
+    }
+    if (!ok)
+      throw Exception("add_property(): Invalid value of type " + itoa(f.type) + ": " +
+        string(b, e));
+  }
+  bool is_delim(char c) { return (c == ',') || (c == ')') || (c == ']') || (c == '*'); }
+  // offset of the first of c1, c2, c3 at or after pos, content size if none
+  size_t scan(size_t pos, char c1, char c2, char c3) {
+    return orient_scan(content.data() + pos, content.data() + content.size(), c1, c2, c3) -
+      content.data();
+  }
+  // offset of the closing quote of a string starting at pos
+  size_t skip_string(size_t pos, u8 &flags) {
+    while ((pos = scan(pos, '"', '\\', '"')) < content.size()) {
+      if (content[pos] == '"')
+        break;
+      flags |= ORIENT_FIELD_ESCAPED;
+      pos += 2;
+    }
+    return min(pos, content.size());
+  }
+  // offset of the delimiter ending the value at pos, without decoding it
+  size_t skip_value(size_t pos) {
+    char open = content[pos], close;
+    u8 flags;
+    switch (open) {
+      case '"':
+        return skip_string(pos + 1, flags) + 1;
+      case '[':
+        close = ']';
+        break;
+      case '{':
+        close = '}';
+        break;
+      case '(':
+        close = ')';
+        break;
+      default:
+        return scan(pos, ',', ')', ']');
+    }
+    // nested value, strings may hold brackets
+    u32 depth = 0;
+    while ((pos = scan(pos, '"', open, close)) < content.size()) {
+      if (content[pos] == '"')
+        pos = skip_string(pos + 1, flags);
+      else if (content[pos] == open)
+        depth++;
+      else if (!--depth)
+        return pos + 1;
+      pos++;
+    }
+    return content.size();
   }
-  size_t add_property(size_t pos, property_t &p) {
-    size_t collection_start;
-    bool done;
+  size_t add_property(size_t pos, u32 idx) {
+    size_t start, end;
+    u32 prev;
+    u8 type = ORIENT_RECORD_TYPE_UNKNOWN, flags = 0;
     switch (content[pos]) {
       case '"':
-        // string 
-        while ((pos < (content.size() - 1)) && content[++pos] != '"') {
-          if (content[pos] == '\\')
-            pos++;
-          p.data += content[pos];
-        }
+        // string
+        start = ++pos;
+        pos = skip_string(pos, flags);
+        properties.table[idx].val_off = start;
+        properties.table[idx].val_len = min(pos, content.size()) - start;
         pos++;
-        p.type = ORIENT_RECORD_TYPE_STRING;
+        type = ORIENT_RECORD_TYPE_STRING;
         break;
       case '#':
         // link
-        pos++;
-        while ((pos < content.size()) && content[pos] != ',' && content[pos] != ')'
-          && content[pos] != ']' && content[pos] != '*') {
-            if ((content[pos] != ':') && !(content[pos] >= '0' && content[pos] <= '9'))
-              throw Exception("add_property(): Invalid link data: " + itoa(content[pos]));
-            p.data += content[pos++];
+        start = ++pos;
+        while ((pos < content.size()) && !is_delim(content[pos])) {
+            // temporary rids of a transaction have negative positions
+            if ((content[pos] != ':') && !(content[pos] >= '0' && content[pos] <= '9') &&
+              !((content[pos] == '-') && (content[pos - 1] == ':')))
+                throw Exception("add_property(): Invalid link data: " + itoa(content[pos]));
+            pos++;
         }
-        p.type = ORIENT_RECORD_TYPE_LINK;
+        properties.table[idx].val_off = start;
+        properties.table[idx].val_len = pos - start;
+        type = ORIENT_RECORD_TYPE_LINK;
         break;
       case 't':
       case 'f':
         // bool: true or false
-        p.type = ORIENT_RECORD_TYPE_BOOL;
-        p.data = string(content.c_str() + pos, (content[pos] == 't') ? 4 : 5);
-        pos += ((content[pos] == 't') ? 4 : 5);
+        type = ORIENT_RECORD_TYPE_BOOL;
+        properties.table[idx].val_off = pos;
+        properties.table[idx].val_len = (content[pos] == 't') ? 4 : 5;
+        pos += properties.table[idx].val_len;
         break;
       case '[':
-        // array
-        pos++;
-        collection_start = pos;
-        while ((pos < content.size() - 1) && content[pos] != ',' && content[pos] != ')'
-          && content[pos] != ']' && content[pos] != '*') {
-            property_t emb;
+        // array, elements are chained from the collection field
+        start = ++pos;
+        prev = ORIENT_NO_FIELD;
+        while ((pos < content.size() - 1) && !is_delim(content[pos])) {
+            u32 emb = properties.add(0, 0);
+            if (prev == ORIENT_NO_FIELD)
+              properties.table[idx].child = emb;
+            else
+              properties.table[prev].next = emb;
+            prev = emb;
             pos = add_property(pos, emb);
-            p.embedded.push_back(emb);
         }
-        p.type = ORIENT_RECORD_TYPE_COLLECTION;
-        p.data = string(content.c_str() + collection_start, pos - collection_start);
+        type = ORIENT_RECORD_TYPE_COLLECTION;
+        properties.table[idx].val_off = start;
+        properties.table[idx].val_len = pos - start;
         if (content[pos] == ']')
           pos++;
         break;
       case '{':
         // map
-        done = false;
-        while (!done && (pos++ < (content.size() - 1))) {
-          switch (content[pos]) {
-            case '}':
-              p.type = ORIENT_RECORD_TYPE_MAP;
-              pos++;
-              done = true;
-              break;
-            default:
-              p.data += content[pos];
-          }
+        start = pos + 1;
+        pos = skip_value(pos);
+        if (content[pos - 1] == '}') {
+          type = ORIENT_RECORD_TYPE_MAP;
+          properties.table[idx].val_off = start;
+          properties.table[idx].val_len = pos - 1 - start;
         }
         break;
-      case '(':
-        // embedded
-      case '*':
       case ')':
       case ']':
       case ',':
+        // empty value
+        type = ORIENT_RECORD_TYPE_NULL;
+        properties.table[idx].val_off = pos;
+        break;
+      case '(':
+        // embedded
+      case '*':
         throw Exception("add_property(): Unimplemented type: " + itoa(content[pos]));
       default:
-        // plain value
-        done = false;
-        p.type = ORIENT_RECORD_TYPE_INT; // default type
-        while (!done && (pos < content.size())) {
-          switch (content[pos]) {
-            case ')':
-            case ']':
-            case ',':
-//              if (p.data.size()) {
-//                double number = atof(p.data);
-//              }
-              done = true;
-              break;
-            case 'b':
-              p.type = ORIENT_RECORD_TYPE_BYTE;
-//              if (p.data.size()) {
-//              }
-              pos++;
-              done = true;
-              break;
-            case 's':
-              p.type = ORIENT_RECORD_TYPE_SHORT;
-              pos++;
-              done = true;
-              break;
-            case 'i':
-              p.type = ORIENT_RECORD_TYPE_INT;
-              pos++;
-              done = true;
-              break;
-            case 'l':
-              p.type = ORIENT_RECORD_TYPE_LONG;
-              pos++;
-              done = true;
-              break;
-            case 'f':
-              p.type = ORIENT_RECORD_TYPE_FLOAT;
-              pos++;
-              done = true;
-              break;
-            case 'd':
-              p.type = ORIENT_RECORD_TYPE_DOUBLE;
-              pos++;
-              done = true;
-              break;
-            case 't':
-              p.type = ORIENT_RECORD_TYPE_DATETIME;
-              pos++;
-              done = true;
-              break;
-            case 'a':
-              p.type = ORIENT_RECORD_TYPE_DATE;
-              pos++;
-              done = true;
-              break;
-            default:
-              if ((content[pos] < '0' || content[pos] > '9') && content[pos] != '.')
-                throw Exception("add_property(): Invalid digit !");
-              p.data += content[pos++];
-          }
+        // plain value, the type is given by the suffix
+        start = pos;
+        pos = scan(pos, ',', ')', ']');
+        if (pos == start) {
+          // empty value at the end of the content
+          type = ORIENT_RECORD_TYPE_NULL;
+          properties.table[idx].val_off = pos;
+          break;
         }
+        type = ORIENT_RECORD_TYPE_INT; // default type
+        end = pos;
+        if ((pos > start) && !(content[pos - 1] >= '0' && content[pos - 1] <= '9') &&
+          (content[pos - 1] != '.')) {
+            end--;
+            switch (content[pos - 1]) {
+              case 'b':
+                type = ORIENT_RECORD_TYPE_BYTE;
+                break;
+              case 's':
+                type = ORIENT_RECORD_TYPE_SHORT;
+                break;
+              case 'i':
+                type = ORIENT_RECORD_TYPE_INT;
+                break;
+              case 'l':
+                type = ORIENT_RECORD_TYPE_LONG;
+                break;
+              case 'f':
+                type = ORIENT_RECORD_TYPE_FLOAT;
+                break;
+              case 'd':
+                type = ORIENT_RECORD_TYPE_DOUBLE;
+                break;
+              case 't':
+                type = ORIENT_RECORD_TYPE_DATETIME;
+                break;
+              case 'a':
+                type = ORIENT_RECORD_TYPE_DATE;
+                break;
+              case 'c':
+                type = ORIENT_RECORD_TYPE_BIGDECIMAL;
+                break;
+              default:
+                throw Exception("add_property(): Invalid digit !");
+            }
+        } else if (memchr(content.data() + start, '.', pos - start))
+            type = ORIENT_RECORD_TYPE_DOUBLE;
+        properties.table[idx].val_off = start;
+        properties.table[idx].val_len = end - start;
     }
+    properties.table[idx].type = type;
+    properties.table[idx].flags = flags;
+    decode(properties.table[idx]);
     if (content[pos] == ',')
       pos++;
     return pos;
   }
-  void parse() {
+  void parse() { parse(0); }
+  // parses only the named fields, the other values are skipped undecoded,
+  // has_property() sees just the projected ones afterwards
+  void parse(const vector<string> &fields) { parse(&fields); }
+  void parse(const vector<string> *fields) {
     if (parsed || !is_document())
       return;
-    size_t curr_pos = 0;
-    string t;
-    // app_log << "full: " << content;
+    properties.clear();
+    properties.content = content;
+    // one field per separator and one per collection is the upper bound,
+    // so the table is allocated once
+    if (!fields) {
+      size_t n = 1;
+      for (const char *c = content.data(), *e = c + content.size(); c < e; c++)
+        n += (*c == ',') || (*c == '[');
+      properties.table.reserve(n);
+    }
+    size_t curr_pos = 0, name_start = 0, found = 0;
     // parse property
     do {
       // try parse class
       if (!properties.size() && !class_.size() && content[curr_pos] == '@') {
-        class_ = t;
-        t.clear();
+        class_ = string(content.data() + name_start, curr_pos - name_start);
         curr_pos++;
+        name_start = curr_pos;
       }
       // parse value
       if (content[curr_pos] == ':') {
-        curr_pos++;
-        property_t p(t);
-        // app_log << "adding prop n: " << p.name << " pos: " << curr_pos;
-        curr_pos = add_property(curr_pos, p);
-        properties.insert(pair<string, property_t>(p.name, p));
-        t.clear();
-      } else if (content[curr_pos] != ')' && content[curr_pos] != ']' && content[curr_pos] != ',' &&
-          content[curr_pos] != '*')
-            t += content[curr_pos++]; // or collect name
+        if (fields && !wanted(*fields, name_start, curr_pos - name_start)) {
+          curr_pos = skip_value(curr_pos + 1);
+          if (content[curr_pos] == ',')
+            curr_pos++;
+          name_start = curr_pos;
+          continue;
+        }
+        u32 idx = properties.add(name_start, curr_pos - name_start);
+        properties.append(idx);
+        curr_pos = add_property(curr_pos + 1, idx);
+        name_start = curr_pos;
+        if (fields && (++found == fields->size()))
+          break;
+      } else if (!is_delim(content[curr_pos]))
+          curr_pos++; // or collect name
+        else
+          break;
     } while ((curr_pos < content.size()) &&
         content[curr_pos -1] != ')' && content[curr_pos -1] != '*');
     parsed = true;
   }
+  bool wanted(const vector<string> &fields, size_t off, size_t len) {
+    for (size_t i = 0; i < fields.size(); i++)
+      if ((fields[i].size() == len) && !memcmp(fields[i].data(), content.data() + off, len))
+        return true;
+    return false;
+  }
   string classof() {
     parse();
     return class_;
@@ -741,7 +1606,7 @@ struct orient_record_t {
     switch (type) {
       case ORIENT_SERIALIZED_RECORD:
       case ORIENT_DOCUMENT_RECORD:
-        return content;
+        return content.str();
       case ORIENT_RECORD_ID:
         ss << "#" << rid.id << ":" << rid.pos;
         return ss.str();
@@ -756,9 +1621,35 @@ extern orient_record_t orient_null;
 
 struct orientresult {
   vector <orient_record_t> records;
+  // failure of a batched statement (see orientquery::execute_batch()), empty - it succeeded
+  string error;
+  // linked records sent by the fetch plan, not part of the result
+  map <rid_t, orient_record_t> prefetched;
+  orientchunks chunks;
+  orientarena_ptr arena; // field tables of the records, if any
+  // received record with this rid, prefetched or not, 0 - none
+  orient_record_t *resolve(const rid_t &rid) {
+    map <rid_t, orient_record_t>::iterator it = prefetched.find(rid);
+    if (it != prefetched.end())
+      return &it->second;
+    for (size_t i = 0; i < records.size(); i++)
+      if (records[i].rid == rid)
+        return &records[i];
+    return 0;
+  }
+  orient_record_t *resolve(property_t &link) { return resolve(link.as_link()); }
+  orientresult(bool zero_copy = false, bool use_arena = false) : chunks(zero_copy || use_arena) {
+    if (use_arena)
+      arena = boost::make_shared<orientarena>();
+  }
 };
 
-typedef boost::shared_ptr<orientresult> orientresult_ptr;
+struct orientop;
+class orientpipeline;
+class orientcursor;
+typedef boost::shared_ptr<orientcursor> orientcursor_ptr;
+// called for every record as it is received, false stops handing out records
+typedef boost::function<bool (orient_record_t &)> orientrecord_handler;
 
 class orientquery {
   orientdb *db;
@@ -766,13 +1657,41 @@ class orientquery {
   string q;
   bool prepared;
   bool autocommit_;
+  bool zero_copy_;
+  bool arena_;
+  string fetchplan_;
+  orientsrv_buf req; // reused by every execute()
+  // command up to the parameters, encoded once per query text and type
+  orientsrv_buf envelope;
+  int envelope_type;
+  bool inserts_;
+  vector <string> params; // bound values, CSV serialized
+  string params_buf;
+  // queued statements of the batch
+  boost::shared_ptr<orientpipeline> batch_;
+  vector <orientresult_ptr> batch_results;
+  vector <bool> batch_inserts;
+  vector <rid_t> batch_ids;
   u64 update_counter_;
   ostringstream buf;
   orientquery& operator= (const orientquery&) = delete;
   orientquery& operator== (const orientquery&) = delete;
   orientquery(const orientquery &)  = delete;
-  orient_record_t parse_record(orientrsp &rsp);
-  u32 parse_records_collection(orientrsp &rsp, vector <orient_record_t> *records);
+  orient_record_t parse_record(orientrsp &rsp, orientresult *result = 0);
+  u32 parse_records_collection(orientrsp &rsp, orientresult *result);
+  void encode(orientsrv_buf &r, int query_type, bool async = false);
+  orientcursor_ptr open_cursor(int query_type, bool async);
+  void encode_envelope(int query_type);
+  void encode_params(orientsrv_buf &r);
+  void text(const string &s) {
+    if (s != q) {
+      q = s;
+      envelope_type = -1;
+    }
+  }
+  void bind(uint pos, const string &val);
+  void parse_result(orientrsp &rsp, orientresult *result);
+  orientop command_op(int query_type, orientresult_ptr result);
 public:
   orient_record_t insert_id;
   const char *str() { return buf.str().size() ? buf.str().c_str() : q.c_str(); }
@@ -784,18 +1703,45 @@ public:
     //    ps = 0;
     //  }
       prepared = false;
+      params.clear();
     }
     return *this;
   }
   void autocommit(bool ac) { autocommit_ = ac; }
-  // prepared stuff
-  void set(uint pos, string &val); // throw(Exception);
+  // records of the result share its receive chunks instead of owning their content
+  void zero_copy(bool z) { zero_copy_ = z; }
+  // records and their parsed fields are carved from big per-result blocks, implies zero_copy
+  void arena(bool a) { arena_ = a; }
+  // linked records to send along with the result, e.g. "*:1" - direct neighbours,
+  // they are available through orientresult::resolve()
+  void fetchplan(const string &fp) {
+    if (fp != fetchplan_) {
+      fetchplan_ = fp;
+      envelope_type = -1;
+    }
+  }
+  // prepared stuff: values of the '?' placeholders, pos is 0 based. The query text is
+  // fixed by the first set() and encoded once, only the parameters go out per execute()
+  void set(uint pos, const string &val); // throw(Exception);
+  void set(uint pos, const char *val);
+  void set(uint pos, int val);
+  void set(uint pos, s64 val);
+  void set(uint pos, double val);
+  void set(uint pos, bool val);
+  void set(uint pos, rid_t val);
+  void set_null(uint pos);
+  void clear_params() { params.clear(); }
   u64 affected_rows() { return update_counter_; }
   orientquery(orientdb &db_, const char *qs = 0) : db(&db_), q(qs ? qs : ""), prepared(false),
-    autocommit_(true) { }
+    autocommit_(true), zero_copy_(false), arena_(false),
+    envelope_type(-1), inserts_(false) { }
   orientquery(orientdb *db_, const char *qs = 0) : db(db_), q(qs ? qs : ""), prepared(false),
-    autocommit_(true) { }
-  orientquery(orientdb &db_, string qs) : db(&db_), q(qs), prepared(false), autocommit_(true) { }
+    autocommit_(true), zero_copy_(false), arena_(false),
+    envelope_type(-1), inserts_(false) { }
+  orientquery(orientdb &db_, string qs) : db(&db_), q(qs), prepared(false), autocommit_(true), zero_copy_(false), arena_(false),
+    envelope_type(-1), inserts_(false) { }
+  orientquery(orientdb *db_, string qs) : db(db_), q(qs), prepared(false), autocommit_(true), zero_copy_(false), arena_(false),
+    envelope_type(-1), inserts_(false) { }
   ~orientquery() {
     //if (ps)
     //  ps->close();
@@ -808,6 +1754,112 @@ public:
 #else
   orientresult_ptr execute(const char *qs = 0, int query_type = AS_SQL);
 #endif
+  // query text is taken from the stream, the query object may be reused right away
+  void execute_async(orientresult_handler h, int query_type = AS_SQL);
+  boost::unique_future<orientresult_ptr> execute_async(int query_type = AS_SQL);
+  // records are decoded one by one from the socket by orientcursor::next(),
+  // the connection is busy until the cursor is drained or closed
+  orientcursor_ptr cursor(int query_type = AS_SQL) { return open_cursor(query_type, false); }
+  // server async mode, records are pushed one by one and handed to h while the server
+  // is still producing the rest, returns the number of records seen.
+  // h runs with the connection locked: it must not use the same orientdb (deadlock).
+  // Returning false does not stop the server, the rest of the stream is read and skipped
+  u64 execute_each(orientrecord_handler h, int query_type = AS_SQL);
+  // batching: add_batch() queues the collected statement (with its bound parameters),
+  // execute_batch() ships the whole batch in one round trip and returns the results
+  // in order, nothing is thrown: a failed statement has orientresult::error set.
+  // Statements are not a transaction, each one answered without error is applied, a server
+  // error fails only its own statement. When the connection breaks, the statements left
+  // without response get its error and may or may not have been applied
+  void add_batch(int query_type = AS_SQL);
+  vector <orientresult_ptr> execute_batch();
+  size_t batched() { return batch_results.size(); }
+  // ids created by the statements of the last batch, not valid for other statements
+  // and for the failed ones
+  const vector <rid_t> &insert_ids() { return batch_ids; }
+  friend class orientpipeline;
+  friend class orientcursor;
+  friend class orientbench;
+};
+
+// forward only reader of a command response, keeps one record in memory at a time
+class orientcursor {
+  orientquery parser;
+  // released as soon as the last record is read, the connection is free again
+  boost::shared_ptr<orientrsp> rsp;
+  u8 status;
+  u32 remaining; // records left in a collection
+  bool done;
+  u64 count;
+  bool read(orient_record_t &r);
+  void finish() {
+    done = true;
+    rsp.reset();
+  }
+  orientcursor& operator= (const orientcursor&) = delete;
+  orientcursor(const orientcursor &)  = delete;
+public:
+  orientcursor(orientdb *db, orientrsp &r);
+  ~orientcursor();
+  bool next(orient_record_t &r);
+  bool eof() { return done; }
+  u64 fetched() { return count; }
+  // skips the rest of the response, the connection is usable again
+  void close();
+};
+
+// request with its response parser and completion
+struct orientop {
+  typedef boost::function<void (orientrsp &)> parser;
+  typedef boost::function<void (const string &)> completion; // empty error - success
+  u8 cmd;
+  orientsrv_buf req;
+  parser parse;
+  completion done;
+};
+
+// writes queued requests back-to-back and reads the responses in order,
+// one round trip for the whole batch
+class orientpipeline {
+  orientdb *db;
+  vector <orientop> ops;
+  orientpipeline& operator= (const orientpipeline&) = delete;
+  orientpipeline(const orientpipeline &)  = delete;
+  static void parse_load(orientdb *db, rid_t rid, orientresult_ptr result, orientrsp &rsp);
+public:
+  orientpipeline(orientdb &db_) : db(&db_) { }
+  orientpipeline(orientdb *db_) : db(db_) { }
+  void add(const orientop &op) { ops.push_back(op); }
+  // results are filled by flush()
+  orientresult_ptr command(string qs, int query_type = AS_SQL,
+    orientop::completion done = orientop::completion());
+  orientresult_ptr load(rid_t rid, string fetchplan = "",
+    orientop::completion done = orientop::completion());
+  size_t size() { return ops.size(); }
+  void clear() { ops.clear(); }
+  // completions are called after the connection is released
+  void flush();
+};
+
+// per database dispatcher, one thread drains queued requests in pipelined batches
+class orientasync {
+  orientdb *db;
+  boost::mutex m_lock;
+  boost::condition_variable m_cond;
+  deque <orientop> queue;
+  boost::thread worker;
+  bool stopping;
+  size_t batch;
+  void run();
+  orientasync& operator= (const orientasync&) = delete;
+  orientasync(const orientasync &)  = delete;
+public:
+  orientasync(orientdb *db_, size_t batch_ = ORIENTPP_DEFAULT_ASYNC_BATCH);
+  ~orientasync() { stop(); }
+  void submit(const orientop &op);
+  // waits for the queued requests, fails the ones submitted after
+  void stop();
+  size_t pending() { boost::unique_lock<boost::mutex> lock(m_lock); return queue.size(); }
 };
 
 // used for client_id generation
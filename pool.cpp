@@ -0,0 +1,243 @@
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+#include "db.h"
+
+namespace OrientPP {
+
+orientpool::orientpool(const orientpool_config &c) : cfg(c), total(0)
+{
+ if (!cfg.max_size)
+   throw Exception("orientpool: max_size must be positive");
+ if (cfg.min_size > cfg.max_size)
+   cfg.min_size = cfg.max_size;
+ while (total < cfg.min_size) {
+   idle_.push_back(open_conn());
+   total++;
+ }
+}
+
+orientpool::~orientpool()
+{
+ boost::unique_lock<boost::mutex> lock(m_lock);
+ if (total != idle_.size())
+   app_log << "~orientpool(): " << (total - idle_.size()) << " sessions still checked out";
+ for (list <conn_ptr>::iterator it = idle_.begin(); it != idle_.end(); it++) {
+   try {
+     (*it)->db.close();
+   }
+   catch (...) { }
+ }
+ idle_.clear();
+}
+
+orientpool::conn_ptr orientpool::open_conn()
+{
+ conn_ptr c(cfg.io_service ? new conn_t(*cfg.io_service, cfg.url) : new conn_t(cfg.url));
+ c->db.cache(cfg.cache);
+ c->db.open(cfg.db, cfg.db_type, cfg.user, cfg.pass);
+ return c;
+}
+
+// cheap round trip, reopens the session if the server dropped it
+bool orientpool::healthy(conn_ptr c)
+{
+ try {
+   c->db.size();
+   return true;
+ }
+ catch (...) { }
+ try {
+   c->db.reopen();
+   return true;
+ }
+ catch (std::exception &e) {
+   app_log << "orientpool: dropping dead connection: " << e.what();
+ }
+ return false;
+}
+
+orientpool::session orientpool::checkout()
+{
+ boost::unique_lock<boost::mutex> lock(m_lock);
+ reap(lock);
+ boost::system_time until = boost::get_system_time() +
+   boost::posix_time::seconds(cfg.checkout_timeout);
+ while (1) {
+   if (idle_.size()) {
+     // most recently used first, cold connections age out at the front
+     conn_ptr c = idle_.back();
+     idle_.pop_back();
+     bool probe = (time(0) - c->last_used) >= cfg.health_interval;
+     lock.unlock();
+     if (!probe || healthy(c))
+       return session(this, c);
+     lock.lock();
+     total--;
+     continue;
+   }
+   if (total < cfg.max_size) {
+     total++;
+     lock.unlock();
+     try {
+       return session(this, open_conn());
+     }
+     catch (...) {
+       lock.lock();
+       total--;
+       m_cond.notify_one();
+       throw;
+     }
+   }
+   if (!cfg.checkout_timeout)
+     m_cond.wait(lock);
+   else if (!m_cond.timed_wait(lock, until) && !idle_.size() && (total >= cfg.max_size))
+     throw Exception("orientpool::checkout(): Timeout waiting for free connection");
+ }
+}
+
+void orientpool::release(conn_ptr c, bool broken)
+{
+ boost::unique_lock<boost::mutex> lock(m_lock);
+ if (broken)
+   total--;
+ else {
+   c->last_used = time(0);
+   idle_.push_back(c);
+ }
+ reap(lock);
+ m_cond.notify_one();
+}
+
+struct orientpool::scan_state {
+  struct range {
+    s16 id;
+    s64 from, to;
+  };
+  boost::mutex m_lock;
+  vector <range> chunks;
+  size_t next;
+  u64 delivered;
+  bool stop;
+  string error;
+  scan_state() : next(0), delivered(0), stop(false) { }
+};
+
+u64 orientpool::scan(const vector <s16> &cluster_ids, orientrecord_handler h, size_t chunk,
+  size_t threads)
+{
+ scan_state st;
+ if (!chunk)
+   chunk = ORIENTPP_DEFAULT_SCAN_CHUNK;
+ {
+   session s = checkout();
+   for (size_t i = 0; i < cluster_ids.size(); i++) {
+     s64 begin, end;
+     s->cluster_range(cluster_ids[i], begin, end);
+     if ((begin < 0) || (end < begin)) // empty
+       continue;
+     for (s64 from = begin; from <= end; from += chunk) {
+       scan_state::range r;
+       r.id = cluster_ids[i];
+       r.from = from;
+       r.to = min(end, from + (s64)chunk - 1);
+       st.chunks.push_back(r);
+     }
+   }
+ }
+ if (!threads)
+   threads = cfg.max_size;
+ threads = min(threads, st.chunks.size());
+ boost::thread_group workers;
+ for (size_t i = 0; i < threads; i++)
+   workers.create_thread(boost::bind(&orientpool::scan_worker, this, &st, h));
+ workers.join_all();
+ if (st.error.size())
+   throw Exception("orientpool::scan(): " + st.error);
+ return st.delivered;
+}
+
+u64 orientpool::scan(const string &class_name, orientrecord_handler h, size_t chunk,
+  size_t threads)
+{
+ vector <s16> ids;
+ {
+   session s = checkout();
+   ids = s->class_clusters(class_name);
+ }
+ if (!ids.size())
+   throw Exception("orientpool::scan(): No clusters for class " + class_name);
+ return scan(ids, h, chunk, threads);
+}
+
+void orientpool::scan_worker(scan_state *st, orientrecord_handler h)
+{
+ try {
+   session s = checkout();
+   while (1) {
+     scan_state::range r;
+     {
+       boost::unique_lock<boost::mutex> lock(st->m_lock);
+       if (st->stop || (st->next >= st->chunks.size()))
+         return;
+       r = st->chunks[st->next++];
+     }
+     // one round trip per chunk, deleted positions come back empty
+     orientpipeline p(s.get());
+     vector <orientresult_ptr> results;
+     results.reserve(r.to - r.from + 1);
+     for (s64 pos = r.from; pos <= r.to; pos++)
+       results.push_back(p.load(rid_t(r.id, pos)));
+     p.flush();
+     u64 n = 0;
+     for (size_t i = 0; i < results.size(); i++)
+       for (size_t j = 0; j < results[i]->records.size(); j++) {
+         n++;
+         if (!h(results[i]->records[j])) {
+           boost::unique_lock<boost::mutex> lock(st->m_lock);
+           st->delivered += n;
+           st->stop = true;
+           return;
+         }
+       }
+     boost::unique_lock<boost::mutex> lock(st->m_lock);
+     st->delivered += n;
+   }
+ }
+ catch (std::exception &e) {
+   boost::unique_lock<boost::mutex> lock(st->m_lock);
+   if (!st->error.size())
+     st->error = e.what();
+   st->stop = true;
+ }
+}
+
+void orientpool::reap()
+{
+ boost::unique_lock<boost::mutex> lock(m_lock);
+ reap(lock);
+}
+
+void orientpool::reap(boost::unique_lock<boost::mutex> &lock)
+{
+ list <conn_ptr> expired;
+ time_t now = time(0);
+ while ((total > cfg.min_size) && idle_.size() &&
+   ((now - idle_.front()->last_used) > cfg.idle_timeout)) {
+     expired.push_back(idle_.front());
+     idle_.pop_front();
+     total--;
+ }
+ if (!expired.size())
+   return;
+ lock.unlock();
+ for (list <conn_ptr>::iterator it = expired.begin(); it != expired.end(); it++) {
+   try {
+     (*it)->db.close();
+   }
+   catch (...) { }
+ }
+ expired.clear();
+ lock.lock();
+}
+
+};
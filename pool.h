@@ -0,0 +1,103 @@
+
+// Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
+
+#ifndef _ORIENTPP_POOL_H_
+#define _ORIENTPP_POOL_H_
+
+#include <list>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace OrientPP {
+
+enum {
+  ORIENTPP_DEFAULT_POOL_MIN = 1,
+  ORIENTPP_DEFAULT_POOL_MAX = 8,
+  ORIENTPP_DEFAULT_POOL_IDLE_TIMEOUT = 60,
+  ORIENTPP_DEFAULT_POOL_HEALTH_INTERVAL = 30,
+  ORIENTPP_DEFAULT_SCAN_CHUNK = 256
+};
+
+struct orientpool_config {
+  string url;                   // server host[:port]
+  string db, user, pass;        // database credentials
+  int db_type;
+  size_t min_size, max_size;
+  int idle_timeout;             // seconds, idle connections above min_size are closed
+  int health_interval;          // seconds, idle connections are probed before checkout
+  int checkout_timeout;         // seconds to wait for a free connection, 0 - forever
+  // event loop shared by all the connections (see orientio), 0 - private one per connection
+  boost::asio::io_service *io_service;
+  orientcache *cache;           // record cache shared by the connections, 0 - none
+  orientpool_config(string url_, string db_, string user_, string pass_,
+    int db_type_ = AS_GRAPH_DB) : url(url_), db(db_), user(user_), pass(pass_),
+    db_type(db_type_), min_size(ORIENTPP_DEFAULT_POOL_MIN),
+    max_size(ORIENTPP_DEFAULT_POOL_MAX), idle_timeout(ORIENTPP_DEFAULT_POOL_IDLE_TIMEOUT),
+    health_interval(ORIENTPP_DEFAULT_POOL_HEALTH_INTERVAL), checkout_timeout(0),
+    io_service(0), cache(0) { }
+};
+
+// pool of exclusive DB sessions, each one with its own server connection
+class orientpool {
+  struct conn_t {
+    orientsrv srv;
+    orientdb db;
+    time_t last_used;
+    conn_t(string &url) : srv(url), db(srv), last_used(time(0)) { }
+    conn_t(boost::asio::io_service &ios, string &url) : srv(ios, url), db(srv),
+      last_used(time(0)) { }
+  };
+  typedef boost::shared_ptr<conn_t> conn_ptr;
+  orientpool_config cfg;
+  boost::mutex m_lock;
+  boost::condition_variable m_cond;
+  list <conn_ptr> idle_;
+  size_t total; // idle + checked out + being opened
+  conn_ptr open_conn();
+  bool healthy(conn_ptr c);
+  void release(conn_ptr c, bool broken);
+  void reap(boost::unique_lock<boost::mutex> &lock);
+  struct scan_state;
+  void scan_worker(scan_state *st, orientrecord_handler h);
+  orientpool& operator= (const orientpool&) = delete;
+  orientpool(const orientpool &)  = delete;
+ public:
+  // RAII checkout, returns the connection to the pool when destroyed
+  class session {
+    orientpool *pool;
+    conn_ptr c;
+    bool broken;
+    session& operator= (const session&) = delete;
+    session(const session &) = delete;
+   public:
+    session(orientpool *p, conn_ptr c_) : pool(p), c(c_), broken(false) { }
+    session(session &&s) : pool(s.pool), c(s.c), broken(s.broken) { s.c.reset(); }
+    ~session() {
+      if (c)
+        pool->release(c, broken);
+    }
+    orientdb &operator*() { return c->db; }
+    orientdb *operator->() { return &c->db; }
+    orientdb *get() { return &c->db; }
+    // connection is in unknown state, do not return it to the pool
+    void invalidate() { broken = true; }
+  };
+  orientpool(const orientpool_config &c);
+  ~orientpool();
+  session checkout();
+  void reap();
+  // reads whole clusters: their position ranges are split into chunks of pipelined loads,
+  // spread over up to threads pooled connections (max_size by default). h is called from
+  // the worker threads, false stops the scan. Returns the number of records delivered.
+  u64 scan(const vector <s16> &cluster_ids, orientrecord_handler h,
+    size_t chunk = ORIENTPP_DEFAULT_SCAN_CHUNK, size_t threads = 0);
+  // clusters of the class taken from the cluster catalog
+  u64 scan(const string &class_name, orientrecord_handler h,
+    size_t chunk = ORIENTPP_DEFAULT_SCAN_CHUNK, size_t threads = 0);
+  size_t size() { boost::unique_lock<boost::mutex> lock(m_lock); return total; }
+  size_t idle() { boost::unique_lock<boost::mutex> lock(m_lock); return idle_.size(); }
+};
+
+}; // namespace
+
+#endif
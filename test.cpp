@@ -1,10 +1,14 @@
 
 // Copyright (C) 2012, Rus V. Brushkoff, All rights reserved
 
+#include <boost/thread.hpp>
+#include <boost/bind/bind.hpp>
 #include "db.h"
 
 using namespace OrientPP;
 
+string server_url("localhost");
+
 string dump_record(orient_record_t &r)
 {
   stringstream ss;
@@ -208,10 +212,81 @@ void dump_tree(orientquery &q, orient_record_t &from, int link_class_id)
 #define TEST_SELECT	1
 #define TEST_RECONNECT	1
 
+#ifdef TEST_POOL
+void pool_worker(orientpool *pool, int n)
+{
+ for (int i = 0; i < n; i++) {
+   orientpool::session s = pool->checkout();
+   orientquery q(*s);
+   q << "select * from ouser where name = 'admin'";
+   app_log << "pool worker got " << q.execute(AS_SQL)->records.size() << " records";
+ }
+}
+
+bool scan_record(orient_record_t &r)
+{
+ app_log << "scan: " << dump_record(r);
+ return true;
+}
+
+void PoolTest()
+{
+ orientpool_config cfg(server_url, "sfinx", "admin", "admin");
+ cfg.max_size = 4;
+ cfg.io_service = &orientio::shared().io_service();
+ orientpool pool(cfg);
+ boost::thread_group workers;
+ for (int i = 0; i < 8; i++)
+   workers.create_thread(boost::bind(pool_worker, &pool, 10));
+ workers.join_all();
+ app_log << "Pool size: " << pool.size() << ", idle: " << pool.idle();
+ app_log << "Scanned " << pool.scan("OUser", scan_record) << " records";
+}
+#endif
+
+#ifdef TEST_PARSE
+// record contents the parser must take or refuse, no server needed
+void ParseTest()
+{
+ orient_record_t r(ORIENT_DOCUMENT_RECORD, 9, 1, 1, orientbytes("V@a:1,b:"));
+ r.parse();
+ if ((r.get_property("a").as_long() != 1) || !r.get_property("b").is_null())
+   throw Exception("ParseTest: Empty value at the end is not null");
+ const char *limits[] = { "V@n:9223372036854775807l", "V@n:-9223372036854775808l" };
+ for (uint i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+   orient_record_t l(ORIENT_DOCUMENT_RECORD, 9, 1, 1, orientbytes(limits[i]));
+   l.parse();
+   app_log << "parsed " << limits[i] << ": " << l.get_property("n").as_long();
+ }
+ const char *overflows[] = { "V@n:9223372036854775808l", "V@n:-9223372036854775809l",
+   "V@n:99999999999999999999" };
+ for (uint i = 0; i < sizeof(overflows) / sizeof(overflows[0]); i++) {
+   orient_record_t o(ORIENT_DOCUMENT_RECORD, 9, 1, 1, orientbytes(overflows[i]));
+   try {
+     o.parse();
+   }
+   catch (Exception &e) {
+     app_log << "refused " << overflows[i] << ": " << e.what();
+     continue;
+   }
+   throw Exception(string("ParseTest: Overflow not detected in ") + overflows[i]);
+ }
+ // link to a temporary rid, as built inside a transaction
+ orient_record_t t(ORIENT_DOCUMENT_RECORD, 9, 1, 1, orientbytes("V@name:\"Te\",in:#5:-2"));
+ t.parse();
+ if (!(t.get_property("in").as_link() == rid_t(5, -2)))
+   throw Exception("ParseTest: Wrong temporary link " + string(t.get_property("in")));
+ app_log << "ParseTest: Done";
+}
+#endif
+
 void OrientDBTest()
 {
  app_log << "OrientDB test: Start";
- orientsrv server("localhost", "root" , "root");
+#ifdef TEST_PARSE
+ ParseTest();
+#endif
+ orientsrv server(server_url, "root" , "root");
 #if TEST_SHUTDOWN
  server.shutdown();
 #endif
@@ -236,6 +311,167 @@ void OrientDBTest()
  q << "select * from ouser where name = 'admin@admin.com'";
  dump_result(q.execute(AS_SQL));
 #endif
+#ifdef TEST_PIPELINE
+ {
+   orientpipeline p(db);
+   orientresult_ptr users = p.command("select * from ouser");
+   orientresult_ptr roles = p.command("select * from orole");
+   orientresult_ptr admin = p.load(rid_t(5, 0));
+   p.flush();
+   dump_result(users);
+   dump_result(roles);
+   dump_result(admin);
+ }
+#endif
+#ifdef TEST_ASYNC
+ {
+   vector <boost::unique_future<orientresult_ptr> > results;
+   for (int i = 0; i < 100; i++) {
+     q << "select * from ouser where name = 'admin'";
+     results.push_back(q.execute_async(AS_SQL));
+   }
+   boost::unique_future<u64> records = db.count_async();
+   for (uint i = 0; i < results.size(); i++)
+     app_log << "async #" << i << ": " << results[i].get()->records.size() << " records";
+   app_log << "DB records count (async): " << records.get();
+ }
+#ifdef TEST_MOCK
+ {
+   // sync calls next to the dispatcher, which reopens the connection after every broken stream
+   vector <boost::unique_future<orientresult_ptr> > results;
+   for (int i = 0; i < 200; i++) {
+     q << ((i % 10) ? "select from OUser limit 2" : "select from Broken");
+     results.push_back(q.execute_async(AS_SQL));
+     q << "select from OUser limit 3";
+     if (q.execute(AS_SQL)->records.size() != 3)
+       throw Exception("async: Wrong result of a sync query");
+     if (!(i % 7))
+       db.load(rid_t(db.cluster_id("ouser"), i));
+   }
+   uint failed = 0;
+   for (uint i = 0; i < results.size(); i++) {
+     orientresult_ptr res;
+     try {
+       res = results[i].get();
+     }
+     catch (Exception &e) {
+       failed++;
+       continue;
+     }
+     if (res->records.size() != 2)
+       throw Exception("async: Wrong result of an async query");
+   }
+   if (failed < results.size() / 10)
+     throw Exception("async: Broken streams did not fail");
+   app_log << "async next to sync: " << failed << " of " << results.size() << " failed";
+ }
+#endif
+#endif
+
+#ifdef TEST_BATCH
+ {
+   // one round trip for all the statements
+   const char *names[] = { "Go", "Rust", "Lisp" };
+   for (uint i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+     q << "create vertex Slices set name ='" << names[i] << "', description ='Batched'";
+     q.add_batch(AS_SQL);
+     // a failed statement does not take the others with it
+     if (!i) {
+       q << "select from";
+       q.add_batch(AS_SQL);
+     }
+   }
+   vector <orientresult_ptr> results = q.execute_batch();
+   for (uint i = 0; i < results.size(); i++)
+     if (results[i]->error.size())
+       app_log << "batch #" << i << " failed: " << results[i]->error;
+     else
+       app_log << "batch #" << i << ": " << string(q.insert_ids()[i]);
+   if (!results[1]->error.size() || results[0]->error.size() || results[3]->error.size() ||
+     !q.insert_ids()[3].valid)
+       throw Exception("batch: Wrong statement results");
+   q << "delete vertex Slices where description = 'Batched'";
+   dump_result(q.execute(AS_SQL));
+ }
+#endif
+
+#ifdef TEST_CURSOR
+ {
+   // constant memory, records are decoded as they arrive
+   q << "select from OUser";
+   orientcursor_ptr cur = q.cursor(AS_SQL);
+   orient_record_t r;
+   while (cur->next(r))
+     app_log << "cursor: " << dump_record(r);
+   app_log << "cursor fetched " << cur->fetched() << " records";
+ }
+#ifdef TEST_MOCK
+ {
+   // the rest of a broken stream must not be taken for the response of the next query
+   q << "select from Broken";
+   orientcursor_ptr cur = q.cursor(AS_SQL);
+   orient_record_t r;
+   try {
+     while (cur->next(r))
+       ;
+     throw Exception("cursor: Broken stream was read to the end");
+   }
+   catch (Exception &e) {
+     app_log << "cursor failed after " << cur->fetched() << " records: " << e.what();
+   }
+   q << "select from OUser limit 3";
+   orientresult_ptr res = q.execute(AS_SQL);
+   if ((res->records.size() != 3) || (res->records[0].rid.id != db.cluster_id("ouser")) ||
+     (res->records[2].rid.pos != 2))
+       throw Exception("cursor: Wrong result of the query after the failed cursor");
+   app_log << "query after the failed cursor: " << dump_record(res->records[2]);
+ }
+ {
+   // the same when the cursor fails on the response header
+   q << "select from Unknown";
+   bool failed = false;
+   try {
+     q.cursor(AS_SQL);
+   }
+   catch (Exception &e) {
+     app_log << "cursor failed on the header: " << e.what();
+     failed = true;
+   }
+   if (!failed)
+     throw Exception("cursor: Unknown result type was accepted");
+   q << "select from OUser limit 3";
+   orientresult_ptr res = q.execute(AS_SQL);
+   if ((res->records.size() != 3) || (res->records[2].rid.pos != 2))
+     throw Exception("cursor: Wrong result of the query after the failed header");
+ }
+#endif
+#endif
+
+#ifdef TEST_EACH
+ {
+   struct printer {
+     static bool each(orient_record_t &r) {
+       app_log << "pushed: " << dump_record(r);
+       return true;
+     }
+   };
+   q << "select from OUser";
+   app_log << "async mode: " << q.execute_each(printer::each, AS_SQL) << " records";
+ }
+#endif
+
+#ifdef TEST_PREPARED
+ {
+   orientquery ps(db);
+   ps << "select * from ouser where name = ? and status = ?";
+   const char *users[] = { "admin", "reader", "writer" };
+   for (uint i = 0; i < sizeof(users) / sizeof(users[0]); i++) {
+     ps.set(0, users[i]);
+     ps.set(1, "ACTIVE");
+     app_log << "prepared " << users[i] << ": " << ps.execute(AS_SQL)->records.size() << " records";
+   }
+ }
+#endif
 
 #ifdef TEST1
  q << "alter class V superclass orestricted";
@@ -305,6 +541,60 @@ void OrientDBTest()
  dump_tree(q, root_slice, link_class_id);
  dump_tree(q, texts_slice, link_class_id);
 
+#ifdef TEST_TX
+ {
+   // both records go in one TX_COMMIT, the link is remapped by the server
+   db.begin();
+   rid_t tao = db.tx_create(root_slice.rid.id, "Slices@name:\"Tao\",description:\"Way\"");
+   db.tx_create(root_slice.rid.id, "Slices@name:\"Te\",description:\"Virtue\",in:" + string(tao));
+   orienttx_result tx = db.commit();
+   app_log << "committed " << string(tao) << " as " << string(tx.rid(tao));
+   q << "delete vertex Slices where name in ['Tao', 'Te']";
+   dump_result(q.execute(AS_SQL));
+ }
+#endif
+
+#ifdef TEST_CRUD
+ {
+   orient_record_t r = db.load(root_slice.rid);
+   app_log << "loaded " << string(r.rid) << " v" << r.version << ": " << string(r);
+   orient_record_t c = db.create(root_slice.rid.id, "Slices@name:\"Crud\",description:\"Direct\"");
+   c = db.update(c.rid, c.version, "Slices@name:\"Crud\",description:\"Updated\"");
+   app_log << "removed " << string(c.rid) << ": " << db.remove(c.rid, c.version);
+ }
+#endif
+
+#ifdef TEST_CACHE
+ {
+   orientcache cache;
+   db.cache(&cache);
+   for (int i = 0; i < 3; i++)
+     db.load(root_slice.rid);
+   app_log << "cache hits: " << cache.hits() << ", misses: " << cache.misses();
+   db.cache(0);
+ }
+#endif
+
+#ifdef TEST_FETCHPLAN
+ {
+   // the slice and its direct neighbours in one round trip
+   orientquery fq(db);
+   fq.fetchplan("*:1");
+   fq << "select from " << string(texts_slice);
+   orientresult_ptr res = fq.execute(AS_SQL);
+   for (uint i = 0; i < res->records.size(); i++) {
+     orient_record_t &r = res->records[i];
+     if (!r.is_document() || !r.has_property("out"))
+       continue;
+     property_t out = r.get_property("out");
+     for (uint j = 0; j < out.embedded.size(); j++) {
+       orient_record_t *linked = res->resolve(out.embedded[j]);
+       app_log << string(r.rid) << " -> " << (linked ? dump_record(*linked) : "not fetched");
+     }
+   }
+ }
+#endif
+
  // delete tree from slice
  q << "delete from (traverse V.in, E.out from " << string(texts_slice) << ")";
  dump_result(q.execute(AS_SQL));
@@ -327,6 +617,9 @@ void OrientDBTest()
  q.execute(AS_GREMLIN);
 #endif
  db.close();
+#ifdef TEST_POOL
+ PoolTest();
+#endif
  app_log << "OrientDB test: Done";
 }
 
@@ -339,6 +632,16 @@ int main(int argc, char **argv) {
   else
     cout << "[" + time_str() + "] " << "[Init] Logging disabled" << endl;
 
+#ifdef TEST_MOCK
+  // no OrientDB needed, synthetic records
+  orientmock mock;
+  server_url = mock.url();
+#endif
+#ifdef TEST_CAPTURE
+  // print with: make capdump && ./capdump orientpp.cap
+  orientcapture capture("orientpp.cap");
+  orientcapture::global(&capture);
+#endif
   app_log << "[Init] Changeset " << ORIENTPP_CHANGESET << ", changeset number "
     << ORIENTPP_CHANGESET_NUMBER << ", build number " << ORIENTPP_BUILD_NUMBER;
   try {